@@ -48,6 +48,8 @@ rsu_async_cb_data_t *rsu_async_cb_data_new(rsu_task_t *task,
 static void prv_rsu_upnp_cb_data_delete(rsu_async_cb_data_t *cb_data)
 {
 	if (cb_data) {
+		if (cb_data->timeout_id)
+			(void) g_source_remove(cb_data->timeout_id);
 		if (cb_data->free_private)
 			cb_data->free_private(cb_data->private);
 		g_free(cb_data);
@@ -58,7 +60,6 @@ gboolean rsu_async_complete_task(gpointer user_data)
 {
 	rsu_async_cb_data_t *cb_data = user_data;
 
-	cb_data->device->current_task = NULL;
 	cb_data->cb(cb_data->task, cb_data->result, cb_data->error,
 		    cb_data->user_data);
 	prv_rsu_upnp_cb_data_delete(cb_data);
@@ -70,7 +71,6 @@ void rsu_async_task_cancelled(GCancellable *cancellable, gpointer user_data)
 {
 	rsu_async_cb_data_t *cb_data = user_data;
 
-	cb_data->device->current_task = NULL;
 	gupnp_service_proxy_cancel_action(cb_data->proxy, cb_data->action);
 	if (!cb_data->error)
 		cb_data->error = g_error_new(RSU_ERROR, RSU_ERROR_CANCELLED,
@@ -82,6 +82,11 @@ void rsu_async_task_lost_object(gpointer user_data)
 {
 	rsu_async_cb_data_t *cb_data = user_data;
 
+	if (cb_data->timeout_id) {
+		(void) g_source_remove(cb_data->timeout_id);
+		cb_data->timeout_id = 0;
+	}
+
 	if (!cb_data->error)
 		cb_data->error = g_error_new(RSU_ERROR, RSU_ERROR_LOST_OBJECT,
 					     "Renderer died before command "
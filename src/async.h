@@ -44,6 +44,12 @@ struct rsu_async_cb_data_t_ {
 	gpointer private;
 	GDestroyNotify free_private;
 	rsu_device_t *device;
+	const gchar *action_name;
+	GUPnPServiceProxyActionCallback callback;
+	rsu_context_t *context;
+	gint64 start_time;
+	gboolean retried;
+	guint timeout_id;
 };
 
 rsu_async_cb_data_t *rsu_async_cb_data_new(rsu_task_t *task,
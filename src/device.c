@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <libgupnp/gupnp-control-point.h>
+#include <libgupnp/gupnp-error.h>
 #include <libgupnp-av/gupnp-av.h>
 
 #include <string.h>
@@ -32,6 +33,12 @@
 #include "async.h"
 #include "prop-defs.h"
 
+#define RSU_DEVICE_CACHE_KEY_LOCATION "Location"
+#define RSU_DEVICE_CACHE_KEY_FRIENDLY_NAME "FriendlyName"
+#define RSU_DEVICE_CACHE_KEY_PROTOCOL_INFO "SinkProtocolInfo"
+
+#define RSU_DEVICE_RTT_FAILED (60 * G_USEC_PER_SEC)
+
 typedef void (*rsu_device_local_cb_t)(rsu_async_cb_data_t *cb_data);
 
 typedef struct rsu_device_data_t_ rsu_device_data_t;
@@ -39,6 +46,19 @@ struct rsu_device_data_t_ {
 	rsu_device_local_cb_t local_cb;
 };
 
+typedef struct rsu_device_image_profile_t_ rsu_device_image_profile_t;
+struct rsu_device_image_profile_t_ {
+	const gchar *name;
+	guint width;
+	guint height;
+};
+
+static const rsu_device_image_profile_t g_image_profiles[] = {
+	{ "JPEG_SM", 640, 480 },
+	{ "JPEG_MED", 1024, 768 },
+	{ "JPEG_LRG", 4096, 4096 }
+};
+
 static void prv_last_change_cb(GUPnPServiceProxy *proxy,
 			       const char *variable,
 			       GValue *value,
@@ -49,6 +69,13 @@ static void prv_sink_change_cb(GUPnPServiceProxy *proxy,
 			       GValue *value,
 			       gpointer user_data);
 
+static void prv_process_protocol_info(rsu_device_t *device,
+				      const gchar *protocol_info);
+
+static void prv_props_update(rsu_device_t *device, rsu_task_t *task);
+
+static gboolean prv_props_changed_cb(gpointer user_data);
+
 static void prv_unref_variant(gpointer variant)
 {
 	GVariant *var = variant;
@@ -63,6 +90,14 @@ static void prv_props_init(rsu_props_t *props)
 	props->player_props = g_hash_table_new_full(g_str_hash, g_str_equal,
 						    NULL, prv_unref_variant);
 	props->synced = FALSE;
+	props->actions_known = FALSE;
+
+	/* Versions start from the current time so that they keep
+	   increasing when a renderer is lost and found again or when the
+	   service is restarted. */
+
+	props->first_version = g_get_real_time();
+	props->version = props->first_version;
 }
 
 static void prv_props_free(rsu_props_t *props)
@@ -71,6 +106,40 @@ static void prv_props_free(rsu_props_t *props)
 	g_hash_table_unref(props->player_props);
 }
 
+/* Takes ownership of val.  Each change is given a new version and is
+   recorded in the journal read by GetChangesSince and by the idle
+   handler that emits PropertiesChanged. */
+
+static void prv_props_set(rsu_device_t *device, GHashTable *table,
+			  const gchar *name, GVariant *val)
+{
+	rsu_props_t *props = &device->props;
+	GVariant *current;
+	rsu_prop_change_t *change;
+
+	current = g_hash_table_lookup(table, name);
+	if (current && g_variant_equal(current, val)) {
+		g_variant_unref(val);
+		goto finished;
+	}
+
+	g_hash_table_insert(table, (gchar *) name, val);
+
+	++props->version;
+	change = &props->journal[props->version % RSU_PROPS_JOURNAL_SIZE];
+	change->version = props->version;
+	change->props = table;
+	change->name = name;
+
+	if (!device->props_changed_id)
+		device->props_changed_id = g_idle_add(prv_props_changed_cb,
+						      device);
+
+finished:
+
+	return;
+}
+
 static void prv_service_proxies_free(rsu_service_proxies_t *service_proxies)
 {
 	if (service_proxies->av_proxy)
@@ -81,6 +150,31 @@ static void prv_service_proxies_free(rsu_service_proxies_t *service_proxies)
 		g_object_unref(service_proxies->cm_proxy);
 }
 
+/* Unreffing a service proxy cancels its pending actions without
+   invoking their callbacks, so the actions still in flight through a
+   context that is going away are failed here. */
+
+static void prv_context_fail_actions(rsu_context_t *ctx)
+{
+	rsu_async_cb_data_t *cb_data;
+	guint last;
+
+	while (ctx->actions->len) {
+		last = ctx->actions->len - 1;
+		cb_data = g_ptr_array_index(ctx->actions, last);
+		g_ptr_array_remove_index(ctx->actions, last);
+
+		gupnp_service_proxy_cancel_action(cb_data->proxy,
+						  cb_data->action);
+		g_cancellable_disconnect(cb_data->cancellable,
+					 cb_data->cancel_id);
+		cb_data->cancel_id = 0;
+		cb_data->context = NULL;
+
+		rsu_async_task_lost_object(cb_data);
+	}
+}
+
 static void prv_rsu_context_delete(gpointer context)
 {
 	rsu_context_t *ctx = context;
@@ -89,6 +183,9 @@ static void prv_rsu_context_delete(gpointer context)
 	if (ctx) {
 		service_proxies = &ctx->service_proxies;
 
+		prv_context_fail_actions(ctx);
+		g_ptr_array_unref(ctx->actions);
+
 		(void) gupnp_service_proxy_remove_notify(
 			service_proxies->cm_proxy ,"SinkProtocolInfo",
 			prv_sink_change_cb, ctx->device);
@@ -138,8 +235,8 @@ static void prv_merge_meta_data(rsu_device_t *device, const gchar *key,
 		g_variant_builder_add(vb, "{sv}", key, value);
 
 	val = g_variant_ref_sink(g_variant_builder_end(vb));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_METADATA, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_METADATA, val);
 	g_variant_builder_unref(vb);
 }
 
@@ -160,6 +257,8 @@ static void prv_context_new(const gchar *ip_address,
 	ctx->ip_address = g_strdup(ip_address);
 	ctx->device_proxy = proxy;
 	ctx->device = device;
+	ctx->rtt = 0;
+	ctx->actions = g_ptr_array_new();
 	g_object_ref(proxy);
 
 	service_proxies->cm_proxy = (GUPnPServiceProxy *)
@@ -169,13 +268,11 @@ static void prv_context_new(const gchar *ip_address,
 		gupnp_device_info_get_service((GUPnPDeviceInfo *) proxy,
 					      av_type);
 
-	gupnp_service_proxy_set_subscribed(service_proxies->cm_proxy, TRUE);
 	(void) gupnp_service_proxy_add_notify(service_proxies->cm_proxy,
 					      "SinkProtocolInfo", G_TYPE_STRING,
 					      prv_sink_change_cb,
 					      device);
 
-	gupnp_service_proxy_set_subscribed(service_proxies->av_proxy, TRUE);
 	(void) gupnp_service_proxy_add_notify(service_proxies->av_proxy,
 					      "LastChange", G_TYPE_STRING,
 					      prv_last_change_cb,
@@ -187,14 +284,66 @@ static void prv_context_new(const gchar *ip_address,
 	*context = ctx;
 }
 
+static void prv_context_subscribe(rsu_context_t *context, gboolean subscribe)
+{
+	rsu_service_proxies_t *service_proxies = &context->service_proxies;
+
+	gupnp_service_proxy_set_subscribed(service_proxies->cm_proxy,
+					   subscribe);
+	gupnp_service_proxy_set_subscribed(service_proxies->av_proxy,
+					   subscribe);
+}
+
 void rsu_device_append_new_context(rsu_device_t *device,
 				   const gchar *ip_address,
 				   GUPnPDeviceProxy *proxy)
 {
 	rsu_context_t *context;
+	GUPnPDeviceInfo *info = (GUPnPDeviceInfo *) proxy;
+
+	/* Refresh the details we cache about the renderer whenever it is
+	   found again after having no contexts. */
+
+	if (device->contexts->len == 0) {
+		g_free(device->location);
+		device->location = g_strdup(gupnp_device_info_get_location(
+						    info));
+		g_free(device->friendly_name);
+		device->friendly_name =
+			gupnp_device_info_get_friendly_name(info);
+	}
 
 	prv_context_new(ip_address, proxy, device, &context);
 	g_ptr_array_add(device->contexts, context);
+	device->best_context = NULL;
+
+	/* A renderer reachable over several network interfaces would
+	   send us each event once per interface if we subscribed on all
+	   of them.  We only subscribe through a single context. */
+
+	if (!device->event_context) {
+		device->event_context = context;
+
+		if (device->subscribed)
+			prv_context_subscribe(context, TRUE);
+	}
+}
+
+void rsu_device_remove_context(rsu_device_t *device, unsigned int index)
+{
+	rsu_context_t *context = g_ptr_array_index(device->contexts, index);
+	gboolean failover = context == device->event_context;
+
+	(void) g_ptr_array_remove_index(device->contexts, index);
+	device->best_context = NULL;
+
+	if (failover) {
+		device->event_context = device->contexts->len ?
+			rsu_device_get_context(device) : NULL;
+
+		if (device->event_context && device->subscribed)
+			prv_context_subscribe(device->event_context, TRUE);
+	}
 }
 
 void rsu_device_delete(void *device)
@@ -207,38 +356,46 @@ void rsu_device_delete(void *device)
 			(void) g_dbus_connection_unregister_object(
 				dev->connection,
 				dev->ids[i]);
+		if (dev->expiry_id)
+			(void) g_source_remove(dev->expiry_id);
+		if (dev->subscription_id)
+			(void) g_source_remove(dev->subscription_id);
+		if (dev->props_changed_id)
+			(void) g_source_remove(dev->props_changed_id);
 		g_ptr_array_unref(dev->contexts);
+		g_free(dev->location);
+		g_free(dev->friendly_name);
 		g_free(dev->path);
 		prv_props_free(&dev->props);
 		g_free(dev);
 	}
 }
 
-gboolean rsu_device_new(GDBusConnection *connection,
-			GUPnPDeviceProxy *proxy,
-			const gchar *ip_address,
-			guint counter,
-			rsu_interface_info_t *interface_info,
-			void *user_data,
-			rsu_device_t **device)
+static rsu_device_t *prv_device_new(GDBusConnection *connection,
+				     const rsu_settings_t *settings)
 {
 	rsu_device_t *dev = g_new0(rsu_device_t, 1);
-	GString *new_path = NULL;
-	unsigned int i;
 
 	prv_props_init(&dev->props);
+	dev->signalled_version = dev->props.version;
 	dev->connection = connection;
+	dev->settings = settings;
 	dev->contexts = g_ptr_array_new_with_free_func(prv_rsu_context_delete);
 
-	rsu_device_append_new_context(dev, ip_address, proxy);
+	return dev;
+}
 
-	new_path = g_string_new("");
-	g_string_printf(new_path, "%s/%u", RSU_SERVER_PATH, counter);
+static gboolean prv_device_register(rsu_device_t *dev, const gchar *path,
+				    rsu_interface_info_t *interface_info,
+				    void *user_data)
+{
+	unsigned int i;
+	gboolean retval = FALSE;
 
 	for (i = 0; i < RSU_INTERFACE_INFO_MAX; ++i) {
 		dev->ids[i] = g_dbus_connection_register_object(
-			connection,
-			new_path->str,
+			dev->connection,
+			path,
 			interface_info[i].interface,
 			interface_info[i].vtable,
 			user_data, NULL, NULL);
@@ -247,19 +404,133 @@ gboolean rsu_device_new(GDBusConnection *connection,
 			goto on_error;
 	}
 
-	dev->path = g_string_free(new_path, FALSE);
-
-	*device = dev;
-	return TRUE;
+	dev->path = g_strdup(path);
+	retval = TRUE;
 
 on_error:
 
-	if (new_path)
-		g_string_free(new_path, TRUE);
+	return retval;
+}
 
-	rsu_device_delete(dev);
+/* Object paths are derived from the renderer's UDN so that a renderer
+   keeps the same path each time it is found.  Characters that are not
+   allowed in object path elements are escaped as _xx, where xx is the
+   character's value in hex. */
 
-	return FALSE;
+static gchar *prv_path_from_udn(const gchar *udn)
+{
+	GString *path;
+	const guchar *c;
+
+	path = g_string_new(RSU_SERVER_PATH"/");
+
+	for (c = (const guchar *) udn; *c; ++c) {
+		if (g_ascii_isalnum(*c))
+			g_string_append_c(path, *c);
+		else
+			g_string_append_printf(path, "_%02x", *c);
+	}
+
+	return g_string_free(path, FALSE);
+}
+
+gboolean rsu_device_new(GDBusConnection *connection,
+			const rsu_settings_t *settings,
+			GUPnPDeviceProxy *proxy,
+			const gchar *ip_address,
+			const gchar *udn,
+			rsu_interface_info_t *interface_info,
+			void *user_data,
+			rsu_device_t **device)
+{
+	rsu_device_t *dev = prv_device_new(connection, settings);
+	gchar *new_path;
+	gboolean retval;
+
+	rsu_device_append_new_context(dev, ip_address, proxy);
+
+	new_path = prv_path_from_udn(udn);
+	retval = prv_device_register(dev, new_path, interface_info, user_data);
+	g_free(new_path);
+
+	if (retval)
+		*device = dev;
+	else
+		rsu_device_delete(dev);
+
+	return retval;
+}
+
+gboolean rsu_device_new_from_cache(GDBusConnection *connection,
+				   const rsu_settings_t *settings,
+				   GKeyFile *keyfile,
+				   const gchar *udn,
+				   rsu_interface_info_t *interface_info,
+				   void *user_data,
+				   rsu_device_t **device)
+{
+	rsu_device_t *dev = prv_device_new(connection, settings);
+	gchar *path;
+	gchar *protocol_info;
+	GVariant *val;
+	gboolean retval = FALSE;
+
+	path = prv_path_from_udn(udn);
+
+	dev->location = g_key_file_get_string(keyfile, udn,
+					      RSU_DEVICE_CACHE_KEY_LOCATION,
+					      NULL);
+	dev->friendly_name = g_key_file_get_string(
+		keyfile, udn, RSU_DEVICE_CACHE_KEY_FRIENDLY_NAME, NULL);
+
+	if (dev->friendly_name) {
+		val = g_variant_ref_sink(g_variant_new_string(
+						 dev->friendly_name));
+		prv_props_set(dev, dev->props.root_props,
+			      RSU_INTERFACE_PROP_IDENTITY, val);
+	}
+
+	protocol_info = g_key_file_get_string(
+		keyfile, udn, RSU_DEVICE_CACHE_KEY_PROTOCOL_INFO, NULL);
+
+	if (protocol_info) {
+		prv_process_protocol_info(dev, protocol_info);
+		g_free(protocol_info);
+	}
+
+	retval = prv_device_register(dev, path, interface_info, user_data);
+	g_free(path);
+
+	if (retval)
+		*device = dev;
+	else
+		rsu_device_delete(dev);
+
+	return retval;
+}
+
+void rsu_device_save(rsu_device_t *device, const gchar *udn,
+		     GKeyFile *keyfile)
+{
+	GVariant *protocol_info;
+
+	if (device->location)
+		g_key_file_set_string(keyfile, udn,
+				      RSU_DEVICE_CACHE_KEY_LOCATION,
+				      device->location);
+
+	if (device->friendly_name)
+		g_key_file_set_string(keyfile, udn,
+				      RSU_DEVICE_CACHE_KEY_FRIENDLY_NAME,
+				      device->friendly_name);
+
+	protocol_info = g_hash_table_lookup(device->props.root_props,
+					    RSU_INTERFACE_PROP_PROTOCOL_INFO);
+	if (protocol_info)
+		g_key_file_set_string(keyfile, udn,
+				      RSU_DEVICE_CACHE_KEY_PROTOCOL_INFO,
+				      g_variant_get_string(protocol_info,
+							   NULL));
 }
 
 rsu_device_t *rsu_device_from_path(const gchar *path, GHashTable *device_list)
@@ -281,9 +552,15 @@ rsu_device_t *rsu_device_from_path(const gchar *path, GHashTable *device_list)
 	return retval;
 }
 
-rsu_context_t *rsu_device_get_context(rsu_device_t *device)
+/* A loopback context is always preferred.  Otherwise we use the
+   context with the lowest SOAP round trip time.  Contexts whose round
+   trip time has not yet been measured have an rtt of 0, so each new
+   context is tried at least once. */
+
+static rsu_context_t *prv_device_best_context(rsu_device_t *device)
 {
 	rsu_context_t *context;
+	rsu_context_t *best = NULL;
 	unsigned int i;
 	const char ip4_local_prefix[] = "127.0.0.";
 
@@ -292,16 +569,342 @@ rsu_context_t *rsu_device_get_context(rsu_device_t *device)
 		if (!strncmp(context->ip_address, ip4_local_prefix,
 			     sizeof(ip4_local_prefix) - 1) ||
 		    !strcmp(context->ip_address, "::1") ||
-		    !strcmp(context->ip_address, "0:0:0:0:0:0:0:1"))
+		    !strcmp(context->ip_address, "0:0:0:0:0:0:0:1")) {
+			best = context;
+			break;
+		}
+
+		if (!best || context->rtt < best->rtt)
+			best = context;
+	}
+
+	return best;
+}
+
+rsu_context_t *rsu_device_get_context(rsu_device_t *device)
+{
+	if (!device->best_context)
+		device->best_context = prv_device_best_context(device);
+
+	return device->best_context;
+}
+
+static gboolean prv_device_has_context(rsu_device_t *device,
+				       rsu_context_t *context)
+{
+	unsigned int i;
+
+	for (i = 0; i < device->contexts->len; ++i)
+		if (g_ptr_array_index(device->contexts, i) == context)
 			break;
+
+	return i < device->contexts->len;
+}
+
+static void prv_context_update_rtt(rsu_device_t *device,
+				   rsu_context_t *context, gint64 rtt)
+{
+	gint64 old_rtt = context->rtt;
+
+	/* Exponentially weighted moving average, with alpha = 1/8 */
+
+	if (rtt == RSU_DEVICE_RTT_FAILED || !context->rtt ||
+	    context->rtt >= RSU_DEVICE_RTT_FAILED)
+		context->rtt = rtt;
+	else
+		context->rtt = (7 * context->rtt + rtt) / 8;
+
+	if (device->best_context == context) {
+		if (context->rtt > old_rtt)
+			device->best_context = NULL;
+	} else if (device->best_context &&
+		   context->rtt < device->best_context->rtt) {
+		device->best_context = NULL;
+	}
+}
+
+static void prv_action_cancel_timeout(rsu_async_cb_data_t *cb_data)
+{
+	if (cb_data->timeout_id) {
+		(void) g_source_remove(cb_data->timeout_id);
+		cb_data->timeout_id = 0;
+	}
+}
+
+static void prv_action_untrack(rsu_async_cb_data_t *cb_data)
+{
+	if (cb_data->context)
+		(void) g_ptr_array_remove(cb_data->context->actions, cb_data);
+}
+
+static void prv_action_cancelled(GCancellable *cancellable,
+				 gpointer user_data)
+{
+	rsu_async_cb_data_t *cb_data = user_data;
+
+	prv_action_cancel_timeout(cb_data);
+	prv_action_untrack(cb_data);
+	rsu_async_task_cancelled(cancellable, cb_data);
+}
+
+/* Connects cb_data to cancellable.  If the task has already been
+   cancelled, cb_data is completed with an error and FALSE is returned,
+   in which case the action must not be started. */
+
+static gboolean prv_action_connect(rsu_async_cb_data_t *cb_data,
+				   GCancellable *cancellable)
+{
+	gboolean retval = FALSE;
+
+	cb_data->cancellable = cancellable;
+
+	if (g_cancellable_is_cancelled(cancellable)) {
+		cb_data->error = g_error_new(RSU_ERROR, RSU_ERROR_CANCELLED,
+					     "Operation cancelled.");
+		(void) g_idle_add(rsu_async_complete_task, cb_data);
+		goto on_error;
 	}
 
-	if (i == device->contexts->len)
-		context = g_ptr_array_index(device->contexts, 0);
+	cb_data->cancel_id =
+		g_cancellable_connect(cancellable,
+				      G_CALLBACK(prv_action_cancelled),
+				      cb_data, NULL);
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
+
+static gboolean prv_action_timeout_cb(gpointer user_data);
+
+static void prv_action_start(rsu_async_cb_data_t *cb_data,
+			     rsu_context_t *context,
+			     const gchar *action_name,
+			     GUPnPServiceProxyActionCallback callback)
+{
+	guint timeout;
+
+	prv_action_untrack(cb_data);
+	g_ptr_array_add(context->actions, cb_data);
+
+	cb_data->action_name = action_name;
+	cb_data->callback = callback;
+	cb_data->context = context;
+	cb_data->proxy = context->service_proxies.av_proxy;
+	cb_data->start_time = g_get_monotonic_time();
+
+	prv_action_cancel_timeout(cb_data);
+	timeout = rsu_settings_get_action_timeout(cb_data->device->settings,
+						  action_name);
+	if (timeout && cb_data->cancellable)
+		cb_data->timeout_id = g_timeout_add_seconds(
+			timeout, prv_action_timeout_cb, cb_data);
+}
+
+static gboolean prv_action_is_idempotent(const gchar *action_name)
+{
+	return !strcmp(action_name, "GetPositionInfo") ||
+		!strcmp(action_name, "Stop") ||
+		!strcmp(action_name, "Pause");
+}
+
+/* Returns the context through which an action that could not be
+   completed through its own context should be retried, or NULL if the
+   action must not be retried.  An action is retried at most once, and
+   only if it can safely be repeated. */
+
+static rsu_context_t *prv_action_retry_context(rsu_async_cb_data_t *cb_data)
+{
+	rsu_device_t *device = cb_data->device;
+	rsu_context_t *context = NULL;
+
+	if (cb_data->retried || !device->contexts->len ||
+	    !prv_action_is_idempotent(cb_data->action_name))
+		goto on_error;
+
+	context = rsu_device_get_context(device);
+	if (context == cb_data->context)
+		context = NULL;
+
+on_error:
 
 	return context;
 }
 
+static void prv_action_retry(rsu_async_cb_data_t *cb_data,
+			     rsu_context_t *context)
+{
+	g_debug("%s failed, retrying on %s", cb_data->action_name,
+		context->ip_address);
+
+	/* All of the idempotent actions take a single InstanceID
+	   argument. */
+
+	cb_data->retried = TRUE;
+	prv_action_start(cb_data, context, cb_data->action_name,
+			 cb_data->callback);
+	cb_data->action =
+		gupnp_service_proxy_begin_action(cb_data->proxy,
+						 cb_data->action_name,
+						 cb_data->callback, cb_data,
+						 "InstanceID", G_TYPE_INT, 0,
+						 NULL);
+}
+
+/* A renderer that accepts a connection but never answers would
+   otherwise hold up every queued task until libsoup gives up.  When
+   an action's timeout expires we stop using the context it was sent
+   through until that context has been shown to work again.  An action
+   that can be retried is sent again through another context;
+   otherwise it is failed by cancelling it.
+
+   The action, its proxy and the device can only be used while the
+   context is still attached.  Deleting a context clears the context
+   of its actions and removes their timeouts, but should the timeout
+   fire without a context the task is completed directly. */
+
+static gboolean prv_action_timeout_cb(gpointer user_data)
+{
+	rsu_async_cb_data_t *cb_data = user_data;
+	rsu_context_t *context = cb_data->context;
+
+	cb_data->timeout_id = 0;
+
+	g_debug("%s timed out", cb_data->action_name);
+
+	if (context) {
+		prv_context_update_rtt(context->device, context,
+				       RSU_DEVICE_RTT_FAILED);
+		context = prv_action_retry_context(cb_data);
+		if (context) {
+			gupnp_service_proxy_cancel_action(cb_data->proxy,
+							  cb_data->action);
+			prv_action_retry(cb_data, context);
+			goto finished;
+		}
+	}
+
+	if (!cb_data->error)
+		cb_data->error = g_error_new(RSU_ERROR, RSU_ERROR_TIMEOUT,
+					     "%s timed out",
+					     cb_data->action_name);
+
+	if (cb_data->context) {
+		g_cancellable_cancel(cb_data->cancellable);
+	} else {
+		g_cancellable_disconnect(cb_data->cancellable,
+					 cb_data->cancel_id);
+		cb_data->cancel_id = 0;
+		(void) g_idle_add(rsu_async_complete_task, cb_data);
+	}
+
+finished:
+
+	return FALSE;
+}
+
+/* Called when an action completes.  Updates the round trip time of
+   the context the action was sent through.  If the action failed
+   because the renderer could not be reached through that context, and
+   the action can safely be repeated, it is retried once through
+   another context.  Returns TRUE if the action has been retried, in
+   which case its callback will be invoked again. */
+
+static gboolean prv_action_complete(rsu_async_cb_data_t *cb_data,
+				    const GError *upnp_error)
+{
+	rsu_device_t *device = cb_data->device;
+	rsu_context_t *context;
+	gboolean unreachable;
+	gboolean retval = FALSE;
+
+	prv_action_cancel_timeout(cb_data);
+	prv_action_untrack(cb_data);
+
+	unreachable = upnp_error && upnp_error->domain == GUPNP_SERVER_ERROR;
+
+	if (prv_device_has_context(device, cb_data->context)) {
+		if (unreachable)
+			prv_context_update_rtt(device, cb_data->context,
+					       RSU_DEVICE_RTT_FAILED);
+		else if (!upnp_error)
+			prv_context_update_rtt(device, cb_data->context,
+					       g_get_monotonic_time() -
+					       cb_data->start_time);
+	}
+
+	if (!unreachable)
+		goto on_error;
+
+	context = prv_action_retry_context(cb_data);
+	if (!context)
+		goto on_error;
+
+	prv_action_retry(cb_data, context);
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
+
+static void prv_device_subscribe(rsu_device_t *device, gboolean subscribe)
+{
+	if (device->event_context)
+		prv_context_subscribe(device->event_context, subscribe);
+
+	device->subscribed = subscribe;
+}
+
+static gboolean prv_subscription_timeout_cb(gpointer user_data)
+{
+	rsu_device_t *device = user_data;
+	gint64 idle;
+
+	device->subscription_id = 0;
+	idle = (g_get_monotonic_time() - device->last_used) / G_USEC_PER_SEC;
+
+	if (idle < device->subscription_timeout) {
+		device->subscription_id = g_timeout_add_seconds(
+			device->subscription_timeout - idle,
+			prv_subscription_timeout_cb, device);
+	} else {
+		g_debug("Dropping event subscriptions for idle renderer %s",
+			device->path);
+		prv_device_subscribe(device, FALSE);
+	}
+
+	return FALSE;
+}
+
+/* We only subscribe to a renderer's events once a client shows an
+   interest in it.  The subscriptions are dropped once the renderer
+   has not been used for subscription_timeout seconds.  A timeout of 0
+   means that the subscriptions are never dropped. */
+
+void rsu_device_touch(rsu_device_t *device, guint subscription_timeout)
+{
+	device->last_used = g_get_monotonic_time();
+	device->subscription_timeout = subscription_timeout;
+
+	if (!device->subscribed) {
+		/* The evented properties we have may be stale, but they are
+		   the best values available until the initial events sent
+		   by the renderer arrive, so they are kept.  Only the
+		   properties that are not evented are derived again. */
+
+		if (device->props.synced && device->contexts->len)
+			prv_props_update(device, NULL);
+		prv_device_subscribe(device, TRUE);
+	}
+
+	if (subscription_timeout && !device->subscription_id)
+		device->subscription_id = g_timeout_add_seconds(
+			subscription_timeout, prv_subscription_timeout_cb,
+			device);
+}
+
 static void prv_get_prop(rsu_async_cb_data_t *cb_data)
 {
 	rsu_task_get_prop_t *get_prop = &cb_data->task->get_prop;
@@ -350,6 +953,190 @@ static void prv_add_props(GHashTable *props, GVariantBuilder *vb)
 				      (GVariant *) value);
 }
 
+static void prv_get_selected_props(rsu_async_cb_data_t *cb_data)
+{
+	gchar **names = cb_data->task->get_selected_props.prop_names;
+	rsu_props_t *props = &cb_data->device->props;
+	GVariantBuilder vb;
+	GVariant *res;
+
+	/* Names that are not defined for the renderer are skipped so
+	   that a single unsupported property does not fail the call. */
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	for (; *names; ++names) {
+		res = g_hash_table_lookup(props->root_props, *names);
+		if (!res)
+			res = g_hash_table_lookup(props->player_props, *names);
+		if (res)
+			g_variant_builder_add(&vb, "{sv}", *names, res);
+	}
+
+	cb_data->result = g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+static void prv_add_interface_props(GVariantBuilder *vb,
+				    const gchar *interface, GHashTable *props)
+{
+	if (!g_hash_table_size(props))
+		goto finished;
+
+	g_variant_builder_open(vb, G_VARIANT_TYPE("{sa{sv}}"));
+	g_variant_builder_add(vb, "s", interface);
+	g_variant_builder_open(vb, G_VARIANT_TYPE("a{sv}"));
+	prv_add_props(props, vb);
+	g_variant_builder_close(vb);
+	g_variant_builder_close(vb);
+
+finished:
+
+	return;
+}
+
+/* The journal holds the last RSU_PROPS_JOURNAL_SIZE changes.  The
+   root and player properties changed since version since are returned
+   in root_changes and player_changes, which the caller unrefs.  If some
+   of the changes that followed since have been overwritten, or since
+   is not one of our versions, all the properties are returned instead
+   and TRUE is returned. */
+
+static gboolean prv_props_changes_since(rsu_props_t *props, guint64 since,
+					GHashTable **root_changes,
+					GHashTable **player_changes)
+{
+	rsu_prop_change_t *change;
+	GHashTable *changes;
+	gboolean complete;
+	guint64 version;
+
+	complete = since < props->first_version || since > props->version ||
+		props->version - since > RSU_PROPS_JOURNAL_SIZE;
+
+	if (complete) {
+		*root_changes = g_hash_table_ref(props->root_props);
+		*player_changes = g_hash_table_ref(props->player_props);
+		goto finished;
+	}
+
+	*root_changes = g_hash_table_new(g_str_hash, g_str_equal);
+	*player_changes = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (version = since + 1; version <= props->version; ++version) {
+		change = &props->journal[version % RSU_PROPS_JOURNAL_SIZE];
+		changes = change->props == props->root_props ?
+			*root_changes : *player_changes;
+		g_hash_table_insert(changes, (gchar *) change->name,
+				    g_hash_table_lookup(change->props,
+							change->name));
+	}
+
+finished:
+
+	return complete;
+}
+
+static void prv_get_changes(rsu_async_cb_data_t *cb_data)
+{
+	rsu_props_t *props = &cb_data->device->props;
+	GHashTable *root_changes;
+	GHashTable *player_changes;
+	GVariantBuilder vb;
+	gboolean complete;
+
+	complete = prv_props_changes_since(props,
+					   cb_data->task->get_changes.version,
+					   &root_changes, &player_changes);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sa{sv}}"));
+	prv_add_interface_props(&vb, RSU_INTERFACE_SERVER, root_changes);
+	prv_add_interface_props(&vb, RSU_INTERFACE_PLAYER, player_changes);
+
+	cb_data->result = g_variant_ref_sink(
+		g_variant_new("(tb@a{sa{sv}})", props->version, complete,
+			      g_variant_builder_end(&vb)));
+
+	g_hash_table_unref(root_changes);
+	g_hash_table_unref(player_changes);
+}
+
+static void prv_emit_props_changed(rsu_device_t *device,
+				   const gchar *interface,
+				   GHashTable *changes)
+{
+	GVariantBuilder vb;
+	GVariant *changed;
+	GVariant *invalidated;
+
+	if (!g_hash_table_size(changes))
+		goto finished;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	prv_add_props(changes, &vb);
+	changed = g_variant_builder_end(&vb);
+	invalidated = g_variant_new_array(G_VARIANT_TYPE_STRING, NULL, 0);
+
+	(void) g_dbus_connection_emit_signal(device->connection,
+					     NULL,
+					     device->path,
+					     RSU_INTERFACE_PROPERTIES,
+					     RSU_INTERFACE_PROPERTIES_CHANGED,
+					     g_variant_new("(s@a{sv}@as)",
+							   interface, changed,
+							   invalidated),
+					     NULL);
+
+finished:
+
+	return;
+}
+
+/* The properties changed by an event or an action are signalled
+   together, once the event or the action has been processed.  Changes
+   to Position, which is not evented, are not journaled and so are not
+   signalled. */
+
+static gboolean prv_props_changed_cb(gpointer user_data)
+{
+	rsu_device_t *device = user_data;
+	GHashTable *root_changes;
+	GHashTable *player_changes;
+
+	device->props_changed_id = 0;
+
+	/* The properties a renderer has when it is registered are sent
+	   with InterfacesAdded. */
+
+	if (!device->path) {
+		device->signalled_version = device->props.version;
+		goto finished;
+	}
+
+	(void) prv_props_changes_since(&device->props,
+				       device->signalled_version,
+				       &root_changes, &player_changes);
+	device->signalled_version = device->props.version;
+
+	prv_emit_props_changed(device, RSU_INTERFACE_SERVER, root_changes);
+	prv_emit_props_changed(device, RSU_INTERFACE_PLAYER, player_changes);
+
+	g_hash_table_unref(root_changes);
+	g_hash_table_unref(player_changes);
+
+finished:
+
+	return FALSE;
+}
+
+static gboolean prv_names_contain(gchar **names, const gchar *name)
+{
+	for (; *names; ++names)
+		if (!strcmp(*names, name))
+			break;
+
+	return *names != NULL;
+}
+
 static void prv_get_props(rsu_async_cb_data_t *cb_data)
 {
 	rsu_task_get_props_t *get_props = &cb_data->task->get_props;
@@ -444,6 +1231,7 @@ static void prv_add_actions(rsu_device_t *device, const gchar *actions)
 	gboolean previous = FALSE;
 	GVariant *val;
 
+	device->props.actions_known = TRUE;
 	parts = g_strsplit(actions, ",", 0);
 
 	true_val = g_variant_ref_sink(g_variant_new_boolean(TRUE));
@@ -466,33 +1254,33 @@ static void prv_add_actions(rsu_device_t *device, const gchar *actions)
 	}
 
 	g_variant_ref(false_val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_CONTROL, false_val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_CONTROL, false_val);
 
 	val = play ? true_val : false_val;
 	g_variant_ref(val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PLAY, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PLAY, val);
 
 	val = pause ? true_val : false_val;
 	g_variant_ref(val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PAUSE, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PAUSE, val);
 
 	val = seek ? true_val : false_val;
 	g_variant_ref(val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_SEEK, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_SEEK, val);
 
 	val = next ? true_val : false_val;
 	g_variant_ref(val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_NEXT, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_NEXT, val);
 
 	val = previous ? true_val : false_val;
 	g_variant_ref(val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PREVIOUS, val);
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PREVIOUS, val);
 
 	g_variant_unref(true_val);
 	g_variant_unref(false_val);
@@ -504,28 +1292,57 @@ static void prv_add_all_actions(rsu_device_t *device)
 	GVariant *val;
 
 	val = g_variant_ref_sink(g_variant_new_boolean(TRUE));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PLAY, val);
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PAUSE, g_variant_ref(val));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_SEEK, g_variant_ref(val));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_NEXT, g_variant_ref(val));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_PREVIOUS,
-			    g_variant_ref(val));
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_CAN_CONTROL,
-			    g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PLAY, g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PAUSE, g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_SEEK, g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_NEXT, g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_PREVIOUS, g_variant_ref(val));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_CAN_CONTROL, g_variant_ref(val));
+	g_variant_unref(val);
+}
+
+/* Fractions of a second are given either as decimal digits or, as
+   allowed by the AVTransport specification, as F0/F1. */
+
+static gint64 prv_fraction_to_int64(const gchar *fraction)
+{
+	const gchar *slash;
+	gint64 numerator;
+	gint64 denominator;
+	gint64 scale = G_USEC_PER_SEC / 10;
+	gint64 usecs = 0;
+
+	slash = strchr(fraction, '/');
+
+	if (slash) {
+		numerator = g_ascii_strtoll(fraction, NULL, 10);
+		denominator = g_ascii_strtoll(slash + 1, NULL, 10);
+		if (numerator >= 0 && numerator < denominator)
+			usecs = numerator * G_USEC_PER_SEC / denominator;
+	} else {
+		for (; g_ascii_isdigit(*fraction) && scale; ++fraction) {
+			usecs += (*fraction - '0') * scale;
+			scale /= 10;
+		}
+	}
+
+	return usecs;
 }
 
 static gint64 prv_duration_to_int64(const gchar *duration)
 {
 	gchar **parts;
+	gchar *fraction;
 	unsigned int i = 0;
 	unsigned int count;
 	gint64 pos = 0;
+	gint64 usecs = 0;
 
 	parts = g_strsplit(duration, ":", 0);
 	for (count = 0; parts[count]; ++count)
@@ -534,7 +1351,11 @@ static gint64 prv_duration_to_int64(const gchar *duration)
 	if (count != 3)
 		goto on_error;
 
-	/* TODO: This does not handle fractional seconds */
+	fraction = strchr(parts[2], '.');
+	if (fraction) {
+		*fraction = 0;
+		usecs = prv_fraction_to_int64(fraction + 1);
+	}
 
 	i = 1;
 	do {
@@ -544,7 +1365,7 @@ static gint64 prv_duration_to_int64(const gchar *duration)
 		i *= 60;
 	} while (count > 0);
 
-	pos *= 1000000;
+	pos = pos * 1000000 + usecs;
 
 on_error:
 
@@ -581,10 +1402,14 @@ static void prv_add_reltime(rsu_device_t *device, const gchar *reltime)
 	GVariant *val;
 	gint64 pos = prv_duration_to_int64(reltime);
 
+	/* Position is not evented and changes every time it is read, so
+	   its changes are not recorded in the journal.  Otherwise a
+	   client polling Position would soon push every other change out
+	   of the journal. */
+
 	val = g_variant_ref_sink(g_variant_new_int64(pos));
 	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_POSITION,
-			    val);
+			    RSU_INTERFACE_PROP_POSITION, val);
 }
 
 static void prv_found_item(GUPnPDIDLLiteParser *parser,
@@ -702,9 +1527,9 @@ static void prv_add_track_meta_data(rsu_device_t *device, const gchar *metadata,
 			goto on_error;
 	}
 
-	g_hash_table_insert(device->props.player_props,
-			    RSU_INTERFACE_PROP_METADATA,
-			    g_variant_ref_sink(g_variant_builder_end(vb)));
+	prv_props_set(device, device->props.player_props,
+		      RSU_INTERFACE_PROP_METADATA,
+		      g_variant_ref_sink(g_variant_builder_end(vb)));
 
 on_error:
 
@@ -776,8 +1601,8 @@ static void prv_last_change_cb(GUPnPServiceProxy *proxy,
 		val = g_variant_ref_sink(
 			g_variant_new_double(
 				prv_map_transport_speed(play_speed)));
-		g_hash_table_insert(device->props.player_props,
-				    RSU_INTERFACE_PROP_RATE, val);
+		prv_props_set(device, device->props.player_props,
+			      RSU_INTERFACE_PROP_RATE, val);
 		g_free(play_speed);
 	}
 
@@ -785,9 +1610,8 @@ static void prv_last_change_cb(GUPnPServiceProxy *proxy,
 		val = g_variant_ref_sink(
 			g_variant_new_string(
 				prv_map_transport_state(state)));
-		g_hash_table_insert(device->props.player_props,
-				    RSU_INTERFACE_PROP_PLAYBACK_STATUS,
-				    val);
+		prv_props_set(device, device->props.player_props,
+			      RSU_INTERFACE_PROP_PLAYBACK_STATUS, val);
 		g_free(state);
 	}
 
@@ -798,7 +1622,8 @@ on_error:
 
 
 static void prv_as_prop_from_hash_table(const gchar *prop_name,
-					GHashTable *values, GHashTable *props)
+					GHashTable *values,
+					rsu_device_t *device)
 {
 	GVariantBuilder vb;
 	GHashTableIter iter;
@@ -812,7 +1637,39 @@ static void prv_as_prop_from_hash_table(const gchar *prop_name,
 		g_variant_builder_add(&vb, "s", key);
 
 	val = g_variant_ref_sink(g_variant_builder_end(&vb));
-	g_hash_table_insert(props, (gchar *) prop_name, val);
+	prv_props_set(device, device->props.root_props, prop_name, val);
+}
+
+static const rsu_device_image_profile_t *prv_image_profile(const gchar *mime,
+							  const gchar *info)
+{
+	const rsu_device_image_profile_t *retval = NULL;
+	const char pn_prefix[] = "DLNA.ORG_PN=";
+	const gchar *pn;
+	gsize len;
+	unsigned int i;
+
+	if (g_ascii_strcasecmp(mime, "image/jpeg"))
+		goto on_error;
+
+	pn = strstr(info, pn_prefix);
+	if (!pn)
+		goto on_error;
+
+	pn += sizeof(pn_prefix) - 1;
+	len = strcspn(pn, ";");
+
+	for (i = 0; i < G_N_ELEMENTS(g_image_profiles); ++i) {
+		if (strlen(g_image_profiles[i].name) == len &&
+		    !g_ascii_strncasecmp(g_image_profiles[i].name, pn, len)) {
+			retval = &g_image_profiles[i];
+			break;
+		}
+	}
+
+on_error:
+
+	return retval;
 }
 
 static void prv_process_protocol_info(rsu_device_t *device,
@@ -825,15 +1682,16 @@ static void prv_process_protocol_info(rsu_device_t *device,
 	GHashTable *protocols;
 	GHashTable *types;
 	const char http_prefix[] = "http-";
+	const rsu_device_image_profile_t *profile;
+	const rsu_device_image_profile_t *max_profile = NULL;
 
 	protocols = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
 					  NULL);
 	types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
 	val = g_variant_ref_sink(g_variant_new_string(protocol_info));
-	g_hash_table_insert(device->props.root_props,
-			    RSU_INTERFACE_PROP_PROTOCOL_INFO,
-			    val);
+	prv_props_set(device, device->props.root_props,
+		      RSU_INTERFACE_PROP_PROTOCOL_INFO, val);
 
 	entries = g_strsplit(protocol_info, ",", 0);
 
@@ -852,6 +1710,19 @@ static void prv_process_protocol_info(rsu_device_t *device,
 			g_hash_table_insert(types,
 					    g_ascii_strdown(type_info[2], -1),
 					    NULL);
+
+			/* Remember the largest JPEG profile supported so
+			   that hosted images can be scaled down to fit. */
+
+			profile = type_info[3] ?
+				prv_image_profile(type_info[2], type_info[3]) :
+				NULL;
+
+			if (profile && (!max_profile ||
+					profile->width * profile->height >
+					max_profile->width *
+					max_profile->height))
+				max_profile = profile;
 		}
 
 		g_strfreev(type_info);
@@ -859,13 +1730,16 @@ static void prv_process_protocol_info(rsu_device_t *device,
 
 	g_strfreev(entries);
 
+	device->max_image_width = max_profile ? max_profile->width : 0;
+	device->max_image_height = max_profile ? max_profile->height : 0;
+
 	prv_as_prop_from_hash_table(RSU_INTERFACE_PROP_SUPPORTED_URIS,
 				    protocols,
-				    device->props.root_props);
+				    device);
 
 	prv_as_prop_from_hash_table(RSU_INTERFACE_PROP_SUPPORTED_MIME,
 				    types,
-				    device->props.root_props);
+				    device);
 
 	g_hash_table_unref(types);
 	g_hash_table_unref(protocols);
@@ -898,6 +1772,11 @@ static void prv_get_position_info_cb(GUPnPServiceProxy *proxy,
 					    &upnp_error,
 					    "RelTime",
 					    G_TYPE_STRING, &rel_pos, NULL)) {
+		if (prv_action_complete(cb_data, upnp_error)) {
+			g_error_free(upnp_error);
+			goto on_retry;
+		}
+
 		cb_data->error = g_error_new(RSU_ERROR,
 					     RSU_ERROR_OPERATION_FAILED,
 					     "GetPositionInfo operation "
@@ -907,6 +1786,8 @@ static void prv_get_position_info_cb(GUPnPServiceProxy *proxy,
 		goto on_error;
 	}
 
+	(void) prv_action_complete(cb_data, NULL);
+
 	g_strstrip(rel_pos);
 	prv_add_reltime(cb_data->device, rel_pos);
 	g_free(rel_pos);
@@ -914,6 +1795,10 @@ static void prv_get_position_info_cb(GUPnPServiceProxy *proxy,
 on_error:
 
 	device_data->local_cb(cb_data);
+
+on_retry:
+
+	return;
 }
 
 static void prv_get_position_info(GCancellable *cancellable,
@@ -923,19 +1808,22 @@ static void prv_get_position_info(GCancellable *cancellable,
 
 	context = rsu_device_get_context(cb_data->device);
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cancellable,
-				      G_CALLBACK(rsu_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->cancellable = cancellable;
-	cb_data->proxy = context->service_proxies.av_proxy;
+	if (!prv_action_connect(cb_data, cancellable))
+		goto on_cancelled;
+
+	prv_action_start(cb_data, context, "GetPositionInfo",
+			 prv_get_position_info_cb);
 	cb_data->action =
 		gupnp_service_proxy_begin_action(cb_data->proxy,
-						 "GetPositionInfo",
+						 cb_data->action_name,
 						 prv_get_position_info_cb,
 						 cb_data,
 						 "InstanceID", G_TYPE_INT, 0,
 						 NULL);
+
+on_cancelled:
+
+	return;
 }
 
 static void prv_props_update(rsu_device_t *device, rsu_task_t *task)
@@ -949,19 +1837,19 @@ static void prv_props_update(rsu_device_t *device, rsu_task_t *task)
 	context = rsu_device_get_context(device);
 
 	val = g_variant_ref_sink(g_variant_new_boolean(FALSE));
-	g_hash_table_insert(props->root_props, RSU_INTERFACE_PROP_CAN_QUIT,
-			    val);
+	prv_props_set(device, props->root_props,
+		      RSU_INTERFACE_PROP_CAN_QUIT, g_variant_ref(val));
 
-	g_hash_table_insert(props->root_props, RSU_INTERFACE_PROP_CAN_RAISE,
-			    g_variant_ref(val));
+	prv_props_set(device, props->root_props,
+		      RSU_INTERFACE_PROP_CAN_RAISE, g_variant_ref(val));
 
-	g_hash_table_insert(props->root_props,
-			    RSU_INTERFACE_PROP_CAN_SET_FULLSCREEN,
-			    g_variant_ref(val));
+	prv_props_set(device, props->root_props,
+		      RSU_INTERFACE_PROP_CAN_SET_FULLSCREEN,
+		      g_variant_ref(val));
 
-	g_hash_table_insert(props->root_props,
-			    RSU_INTERFACE_PROP_HAS_TRACK_LIST,
-			    g_variant_ref(val));
+	prv_props_set(device, props->root_props,
+		      RSU_INTERFACE_PROP_HAS_TRACK_LIST, g_variant_ref(val));
+	g_variant_unref(val);
 
 	/* TODO:  The following three properties require information to
 	   be read out of the service file to be properly implemented.
@@ -969,22 +1857,26 @@ static void prv_props_update(rsu_device_t *device, rsu_task_t *task)
 	   cancel requests to access the service file */
 
 	val = g_variant_ref_sink(g_variant_new_double(1.0));
-	g_hash_table_insert(props->player_props,
-			    RSU_INTERFACE_PROP_MINIMUM_RATE, val);
-	g_hash_table_insert(props->player_props,
-			    RSU_INTERFACE_PROP_MAXIMUM_RATE,
-			    g_variant_ref(val));
-	g_hash_table_insert(props->player_props,
-			    RSU_INTERFACE_PROP_VOLUME,
-			    g_variant_ref(val));
+	prv_props_set(device, props->player_props,
+		      RSU_INTERFACE_PROP_MINIMUM_RATE, g_variant_ref(val));
+	prv_props_set(device, props->player_props,
+		      RSU_INTERFACE_PROP_MAXIMUM_RATE, g_variant_ref(val));
+	prv_props_set(device, props->player_props,
+		      RSU_INTERFACE_PROP_VOLUME, g_variant_ref(val));
+	g_variant_unref(val);
 
 	info = (GUPnPDeviceInfo *) context->device_proxy;
 	friendly_name = gupnp_device_info_get_friendly_name(info);
 	val = g_variant_ref_sink(g_variant_new_string(friendly_name));
 	g_free(friendly_name);
-	g_hash_table_insert(props->root_props, RSU_INTERFACE_PROP_IDENTITY,
-			    val);
-	prv_add_all_actions(device);
+	prv_props_set(device, props->root_props,
+		      RSU_INTERFACE_PROP_IDENTITY, val);
+
+	/* Until the renderer reports its CurrentTransportActions we
+	   assume that it supports all of them. */
+
+	if (!props->actions_known)
+		prv_add_all_actions(device);
 	device->props.synced = TRUE;
 }
 
@@ -1002,6 +1894,66 @@ static void prv_complete_get_props(rsu_async_cb_data_t *cb_data)
 	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
 }
 
+static void prv_complete_get_selected_props(rsu_async_cb_data_t *cb_data)
+{
+	prv_get_selected_props(cb_data);
+	(void) g_idle_add(rsu_async_complete_task, cb_data);
+	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
+}
+
+/* Returns the root and player properties of device as they were last
+   cached.  The renderer is not contacted, so Position may be out of
+   date. */
+
+GVariant *rsu_device_get_cached_props(rsu_device_t *device)
+{
+	GVariantBuilder vb;
+
+	if (!device->props.synced && device->contexts->len)
+		prv_props_update(device, NULL);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	prv_add_props(device->props.root_props, &vb);
+	prv_add_props(device->props.player_props, &vb);
+
+	return g_variant_builder_end(&vb);
+}
+
+static GVariant *prv_cached_props(GHashTable *props)
+{
+	GVariantBuilder vb;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	if (props)
+		prv_add_props(props, &vb);
+
+	return g_variant_builder_end(&vb);
+}
+
+/* Returns the interfaces of device's server object, other than
+   org.freedesktop.DBus.Properties, each with its cached properties, in
+   the form used by org.freedesktop.DBus.ObjectManager. */
+
+GVariant *rsu_device_get_interfaces(rsu_device_t *device)
+{
+	GVariantBuilder vb;
+
+	if (!device->props.synced && device->contexts->len)
+		prv_props_update(device, NULL);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_variant_builder_add(&vb, "{s@a{sv}}", RSU_INTERFACE_SERVER,
+			      prv_cached_props(device->props.root_props));
+	g_variant_builder_add(&vb, "{s@a{sv}}", RSU_INTERFACE_PLAYER,
+			      prv_cached_props(device->props.player_props));
+	g_variant_builder_add(&vb, "{s@a{sv}}", RSU_INTERFACE_PUSH_HOST,
+			      prv_cached_props(NULL));
+	g_variant_builder_add(&vb, "{s@a{sv}}", RSU_INTERFACE_RENDERER_DEVICE,
+			      prv_cached_props(NULL));
+
+	return g_variant_builder_end(&vb);
+}
+
 void rsu_device_get_prop(rsu_device_t *device, rsu_task_t *task,
 			 GCancellable *cancellable,
 			 rsu_upnp_task_complete_t cb,
@@ -1015,7 +1967,12 @@ void rsu_device_get_prop(rsu_device_t *device, rsu_task_t *task,
 	   If it is we need to call GetPositionInfo.  This value is not evented.
 	   Otherwise we can just update the value straight away. */
 
-	if ((!strcmp(get_prop->interface_name, RSU_INTERFACE_PLAYER) ||
+	/* Renderers loaded from the cache that have not yet been found
+	   on the network have no context.  We can only return the
+	   properties that were cached for them. */
+
+	if (device->contexts->len &&
+	    (!strcmp(get_prop->interface_name, RSU_INTERFACE_PLAYER) ||
 	     !strcmp(get_prop->interface_name, "")) &&
 	    (!strcmp(task->get_prop.prop_name, RSU_INTERFACE_PROP_POSITION))) {
 		/* Need to read the current position.  This property is not
@@ -1033,7 +1990,7 @@ void rsu_device_get_prop(rsu_device_t *device, rsu_task_t *task,
 		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
 						device);
 
-		if (!device->props.synced)
+		if (!device->props.synced && device->contexts->len)
 			prv_props_update(device, task);
 
 		prv_get_prop(cb_data);
@@ -1050,10 +2007,11 @@ void rsu_device_get_all_props(rsu_device_t *device, rsu_task_t *task,
 	rsu_task_get_props_t *get_props = &task->get_props;
 	rsu_device_data_t *device_cb_data;
 
-	if (!device->props.synced)
+	if (!device->props.synced && device->contexts->len)
 		prv_props_update(device, task);
 
-	if ((!strcmp(get_props->interface_name, RSU_INTERFACE_PLAYER) ||
+	if (device->contexts->len &&
+	    (!strcmp(get_props->interface_name, RSU_INTERFACE_PLAYER) ||
 	     !strcmp(get_props->interface_name, ""))) {
 
 		/* Need to read the current position.  This property is not
@@ -1076,6 +2034,57 @@ void rsu_device_get_all_props(rsu_device_t *device, rsu_task_t *task,
 	}
 }
 
+void rsu_device_get_selected_props(rsu_device_t *device, rsu_task_t *task,
+				   GCancellable *cancellable,
+				   rsu_upnp_task_complete_t cb,
+				   void *user_data)
+{
+	rsu_async_cb_data_t *cb_data;
+	gchar **names = task->get_selected_props.prop_names;
+	rsu_device_data_t *device_cb_data;
+
+	if (!device->props.synced && device->contexts->len)
+		prv_props_update(device, task);
+
+	/* Only Position requires a round trip to the renderer.  The
+	   other properties are evented and are served from the cache. */
+
+	if (device->contexts->len &&
+	    prv_names_contain(names, RSU_INTERFACE_PROP_POSITION)) {
+		device_cb_data = g_new(rsu_device_data_t, 1);
+		device_cb_data->local_cb = prv_complete_get_selected_props;
+
+		cb_data = rsu_async_cb_data_new(task, cb, user_data,
+						device_cb_data, g_free,
+						device);
+
+		prv_get_position_info(cancellable, cb_data);
+	} else {
+		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
+						device);
+
+		prv_get_selected_props(cb_data);
+		(void) g_idle_add(rsu_async_complete_task, cb_data);
+	}
+}
+
+void rsu_device_get_changes(rsu_device_t *device, rsu_task_t *task,
+			    GCancellable *cancellable,
+			    rsu_upnp_task_complete_t cb,
+			    void *user_data)
+{
+	rsu_async_cb_data_t *cb_data;
+
+	if (!device->props.synced && device->contexts->len)
+		prv_props_update(device, task);
+
+	cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
+					device);
+
+	prv_get_changes(cb_data);
+	(void) g_idle_add(rsu_async_complete_task, cb_data);
+}
+
 static void prv_simple_call_cb(GUPnPServiceProxy *proxy,
 			       GUPnPServiceProxyAction *action,
 			       gpointer user_data)
@@ -1085,15 +2094,26 @@ static void prv_simple_call_cb(GUPnPServiceProxy *proxy,
 
 	if (!gupnp_service_proxy_end_action(cb_data->proxy, cb_data->action,
 					    &upnp_error, NULL)) {
+		if (prv_action_complete(cb_data, upnp_error)) {
+			g_error_free(upnp_error);
+			goto on_error;
+		}
+
 		cb_data->error = g_error_new(RSU_ERROR,
 					     RSU_ERROR_OPERATION_FAILED,
 					     "Operation "
 					     "failed: %s", upnp_error->message);
 		g_error_free(upnp_error);
+	} else {
+		(void) prv_action_complete(cb_data, NULL);
 	}
 
 	(void) g_idle_add(rsu_async_complete_task, cb_data);
 	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
+
+on_error:
+
+	return;
 }
 
 void rsu_device_play(rsu_device_t *device, rsu_task_t *task,
@@ -1108,20 +2128,23 @@ void rsu_device_play(rsu_device_t *device, rsu_task_t *task,
 	cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
 					device);
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cancellable,
-				      G_CALLBACK(rsu_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->cancellable = cancellable;
-	cb_data->proxy = context->service_proxies.av_proxy;
+	if (!prv_action_connect(cb_data, cancellable))
+		goto on_cancelled;
+
+	prv_action_start(cb_data, context, "Play",
+			 prv_simple_call_cb);
 	cb_data->action =
 		gupnp_service_proxy_begin_action(cb_data->proxy,
-						 "Play",
+						 cb_data->action_name,
 						 prv_simple_call_cb,
 						 cb_data,
 						 "InstanceID", G_TYPE_INT, 0,
 						 "Speed", G_TYPE_STRING, "1",
 						 NULL);
+
+on_cancelled:
+
+	return;
 }
 
 void rsu_device_play_pause(rsu_device_t *device, rsu_task_t *task,
@@ -1153,19 +2176,22 @@ static void prv_simple_command(rsu_device_t *device, rsu_task_t *task,
 	cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
 					device);
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cancellable,
-				      G_CALLBACK(rsu_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->cancellable = cancellable;
-	cb_data->proxy = context->service_proxies.av_proxy;
+	if (!prv_action_connect(cb_data, cancellable))
+		goto on_cancelled;
+
+	prv_action_start(cb_data, context, command_name,
+			 prv_simple_call_cb);
 	cb_data->action =
 		gupnp_service_proxy_begin_action(cb_data->proxy,
-						 command_name,
+						 cb_data->action_name,
 						 prv_simple_call_cb,
 						 cb_data,
 						 "InstanceID", G_TYPE_INT, 0,
 						 NULL);
+
+on_cancelled:
+
+	return;
 }
 void rsu_device_pause(rsu_device_t *device, rsu_task_t *task,
 		      GCancellable *cancellable,
@@ -1216,15 +2242,14 @@ void rsu_device_open_uri(rsu_device_t *device, rsu_task_t *task,
 	cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
 					device);
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cancellable,
-				      G_CALLBACK(rsu_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->cancellable = cancellable;
-	cb_data->proxy = context->service_proxies.av_proxy;
+	if (!prv_action_connect(cb_data, cancellable))
+		goto on_cancelled;
+
+	prv_action_start(cb_data, context, "SetAVTransportURI",
+			 prv_simple_call_cb);
 	cb_data->action =
 		gupnp_service_proxy_begin_action(cb_data->proxy,
-						 "SetAVTransportURI",
+						 cb_data->action_name,
 						 prv_simple_call_cb,
 						 cb_data,
 						 "InstanceID", G_TYPE_INT, 0,
@@ -1233,6 +2258,10 @@ void rsu_device_open_uri(rsu_device_t *device, rsu_task_t *task,
 						 "CurrentURIMetaData",
 						 G_TYPE_STRING, "",
 						 NULL);
+
+on_cancelled:
+
+	return;
 }
 
 static void prv_device_set_position(rsu_device_t *device, rsu_task_t *task,
@@ -1252,15 +2281,14 @@ static void prv_device_set_position(rsu_device_t *device, rsu_task_t *task,
 
 	position = prv_int64_to_duration(seek_data->position);
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cancellable,
-				      G_CALLBACK(rsu_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->cancellable = cancellable;
-	cb_data->proxy = context->service_proxies.av_proxy;
+	if (!prv_action_connect(cb_data, cancellable))
+		goto on_cancelled;
+
+	prv_action_start(cb_data, context, "Seek",
+			 prv_simple_call_cb);
 	cb_data->action =
 		gupnp_service_proxy_begin_action(cb_data->proxy,
-						 "Seek",
+						 cb_data->action_name,
 						 prv_simple_call_cb,
 						 cb_data,
 						 "InstanceID", G_TYPE_INT, 0,
@@ -1270,6 +2298,8 @@ static void prv_device_set_position(rsu_device_t *device, rsu_task_t *task,
 						 G_TYPE_STRING, position,
 						 NULL);
 
+on_cancelled:
+
 	g_free(position);
 }
 
@@ -1302,10 +2332,16 @@ void rsu_device_host_uri(rsu_device_t *device, rsu_task_t *task,
 	rsu_task_host_uri_t *host_uri = &task->host_uri;
 	gchar *url;
 	GError *error = NULL;
+	const SoupURI *url_base;
 
 	context = rsu_device_get_context(device);
+	url_base = gupnp_device_info_get_url_base(
+		(GUPnPDeviceInfo *) context->device_proxy);
 	url = rsu_host_service_add(host_service, context->ip_address,
 				   host_uri->client, host_uri->uri,
+				   url_base ? url_base->host : NULL,
+				   device->max_image_width,
+				   device->max_image_height,
 				   &error);
 
 	cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
@@ -44,6 +44,17 @@ struct rsu_context_t_ {
 	GUPnPDeviceProxy *device_proxy;
 	rsu_service_proxies_t service_proxies;
 	rsu_device_t *device;
+	gint64 rtt;
+	GPtrArray *actions;
+};
+
+#define RSU_PROPS_JOURNAL_SIZE 64
+
+typedef struct rsu_prop_change_t_ rsu_prop_change_t;
+struct rsu_prop_change_t_ {
+	guint64 version;
+	GHashTable *props;
+	const gchar *name;
 };
 
 typedef struct rsu_props_t_ rsu_props_t;
@@ -51,33 +62,66 @@ struct rsu_props_t_ {
 	GHashTable *root_props;
 	GHashTable *player_props;
 	gboolean synced;
+	gboolean actions_known;
+	guint64 first_version;
+	guint64 version;
+	rsu_prop_change_t journal[RSU_PROPS_JOURNAL_SIZE];
 };
 
 struct rsu_device_t_ {
 	GDBusConnection *connection;
+	const rsu_settings_t *settings;
 	guint ids[RSU_INTERFACE_INFO_MAX];
 	gchar *path;
 	GPtrArray *contexts;
-	gpointer current_task;
 	rsu_props_t props;
+	guint max_image_width;
+	guint max_image_height;
+	gchar *location;
+	gchar *friendly_name;
+	guint expiry_id;
+	rsu_context_t *best_context;
+	rsu_context_t *event_context;
+	gboolean subscribed;
+	guint subscription_id;
+	guint subscription_timeout;
+	gint64 last_used;
+	guint64 signalled_version;
+	guint props_changed_id;
 };
 
 gboolean rsu_device_new(GDBusConnection *connection,
+			const rsu_settings_t *settings,
 			GUPnPDeviceProxy *proxy,
 			const gchar *ip_address,
-			guint counter,
+			const gchar *udn,
 			rsu_interface_info_t *interface_info,
 			void *user_data,
 			rsu_device_t **device);
 
+gboolean rsu_device_new_from_cache(GDBusConnection *connection,
+				   const rsu_settings_t *settings,
+				   GKeyFile *keyfile,
+				   const gchar *udn,
+				   rsu_interface_info_t *interface_info,
+				   void *user_data,
+				   rsu_device_t **device);
+
 void rsu_device_delete(void *device);
 
+void rsu_device_save(rsu_device_t *device, const gchar *udn,
+		     GKeyFile *keyfile);
+
 void rsu_device_append_new_context(rsu_device_t *device,
 				   const gchar *ip_address,
 				   GUPnPDeviceProxy *proxy);
+void rsu_device_remove_context(rsu_device_t *device, unsigned int index);
 rsu_device_t *rsu_device_from_path(const gchar *path, GHashTable *device_list);
 rsu_context_t *rsu_device_get_context(rsu_device_t *device);
+void rsu_device_touch(rsu_device_t *device, guint subscription_timeout);
 
+GVariant *rsu_device_get_cached_props(rsu_device_t *device);
+GVariant *rsu_device_get_interfaces(rsu_device_t *device);
 void rsu_device_get_prop(rsu_device_t *device, rsu_task_t *task,
 			GCancellable *cancellable,
 			rsu_upnp_task_complete_t cb,
@@ -86,6 +130,14 @@ void rsu_device_get_all_props(rsu_device_t *device, rsu_task_t *task,
 			      GCancellable *cancellable,
 			      rsu_upnp_task_complete_t cb,
 			      void *user_data);
+void rsu_device_get_selected_props(rsu_device_t *device, rsu_task_t *task,
+				   GCancellable *cancellable,
+				   rsu_upnp_task_complete_t cb,
+				   void *user_data);
+void rsu_device_get_changes(rsu_device_t *device, rsu_task_t *task,
+			    GCancellable *cancellable,
+			    rsu_upnp_task_complete_t cb,
+			    void *user_data);
 void rsu_device_play(rsu_device_t *device, rsu_task_t *task,
 		     GCancellable *cancellable,
 		     rsu_upnp_task_complete_t cb,
@@ -0,0 +1,473 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "discovery.h"
+
+/* GUPnP starts downloading the description of every renderer as soon
+   as it is announced.  When a large number of renderers are announced
+   at the same time, as happens at venue start-up, these downloads all
+   compete with each other and delay the discovery of every renderer.
+   We therefore intercept the control points' resource-available
+   signals and release the announcements to GUPnP a few at a time. */
+
+typedef struct rsu_discovery_entry_t_ rsu_discovery_entry_t;
+struct rsu_discovery_entry_t_ {
+	rsu_discovery_t *discovery;
+	GUPnPControlPoint *cp;
+	gchar *usn;
+	gchar *udn;
+	GList *locations;
+	gint64 announced;
+	gint64 fetch_start;
+	guint timeout_id;
+};
+
+struct rsu_discovery_t_ {
+	rsu_filter_t *filter;
+	guint max_fetches;
+	guint fetch_timeout;
+	GQueue known_queue;
+	GQueue queue;
+	GQueue denied;
+	GPtrArray *fetching;
+	GHashTable *known;
+	gboolean releasing;
+	guint pump_id;
+};
+
+static void prv_discovery_entry_delete(rsu_discovery_entry_t *entry)
+{
+	if (entry->timeout_id)
+		(void) g_source_remove(entry->timeout_id);
+
+	g_object_unref(entry->cp);
+	g_free(entry->usn);
+	g_free(entry->udn);
+	g_list_free_full(entry->locations, g_free);
+	g_free(entry);
+}
+
+static rsu_discovery_entry_t *prv_discovery_entry_new(
+	rsu_discovery_t *discovery, GUPnPControlPoint *cp, const char *usn,
+	GList *locations)
+{
+	rsu_discovery_entry_t *entry;
+	const gchar *end;
+
+	entry = g_new0(rsu_discovery_entry_t, 1);
+	entry->discovery = discovery;
+	entry->cp = g_object_ref(cp);
+	entry->usn = g_strdup(usn);
+	entry->announced = g_get_monotonic_time();
+
+	end = strstr(usn, "::");
+	entry->udn = end ? g_strndup(usn, end - usn) : g_strdup(usn);
+
+	for (; locations; locations = locations->next)
+		entry->locations = g_list_prepend(entry->locations,
+						  g_strdup(locations->data));
+	entry->locations = g_list_reverse(entry->locations);
+
+	return entry;
+}
+
+static gboolean prv_discovery_entry_match(rsu_discovery_entry_t *entry,
+					  GUPnPControlPoint *cp,
+					  const gchar *usn)
+{
+	return entry->cp == cp && !strcmp(entry->usn, usn);
+}
+
+static GList *prv_discovery_find_queued(GQueue *queue, GUPnPControlPoint *cp,
+					const gchar *usn)
+{
+	GList *link;
+
+	for (link = queue->head; link; link = link->next)
+		if (prv_discovery_entry_match(link->data, cp, usn))
+			break;
+
+	return link;
+}
+
+static gboolean prv_discovery_pending(rsu_discovery_t *discovery,
+				      GUPnPControlPoint *cp, const gchar *usn)
+{
+	unsigned int i;
+	gboolean retval = TRUE;
+
+	if (prv_discovery_find_queued(&discovery->known_queue, cp, usn) ||
+	    prv_discovery_find_queued(&discovery->queue, cp, usn) ||
+	    prv_discovery_find_queued(&discovery->denied, cp, usn))
+		goto on_error;
+
+	for (i = 0; i < discovery->fetching->len; ++i)
+		if (prv_discovery_entry_match(
+			    g_ptr_array_index(discovery->fetching, i), cp, usn))
+			goto on_error;
+
+	retval = FALSE;
+
+on_error:
+
+	return retval;
+}
+
+static void prv_discovery_schedule(rsu_discovery_t *discovery);
+
+static gboolean prv_discovery_timeout_cb(gpointer user_data)
+{
+	rsu_discovery_entry_t *entry = user_data;
+	rsu_discovery_t *discovery = entry->discovery;
+
+	g_debug("Description of %s not received after %u seconds",
+		entry->udn, discovery->fetch_timeout);
+
+	entry->timeout_id = 0;
+	(void) g_ptr_array_remove_fast(discovery->fetching, entry);
+	prv_discovery_entry_delete(entry);
+	prv_discovery_schedule(discovery);
+
+	return FALSE;
+}
+
+static void prv_discovery_release(rsu_discovery_t *discovery,
+				  rsu_discovery_entry_t *entry)
+{
+	entry->fetch_start = g_get_monotonic_time();
+	entry->timeout_id = g_timeout_add_seconds(discovery->fetch_timeout,
+						  prv_discovery_timeout_cb,
+						  entry);
+	g_ptr_array_add(discovery->fetching, entry);
+
+	g_debug("Fetching description of %s after %.3f s in queue",
+		entry->udn,
+		(entry->fetch_start - entry->announced) / 1000000.0);
+
+	/* Let the announcement through to the control point, which will
+	   download the description and create the device proxy. */
+
+	discovery->releasing = TRUE;
+	g_signal_emit_by_name(entry->cp, "resource-available", entry->usn,
+			      entry->locations);
+	discovery->releasing = FALSE;
+}
+
+static gboolean prv_discovery_pump(gpointer user_data)
+{
+	rsu_discovery_t *discovery = user_data;
+	rsu_discovery_entry_t *entry;
+
+	discovery->pump_id = 0;
+
+	while (discovery->fetching->len < discovery->max_fetches) {
+		entry = g_queue_pop_head(&discovery->known_queue);
+		if (!entry)
+			entry = g_queue_pop_head(&discovery->queue);
+		if (!entry)
+			break;
+
+		prv_discovery_release(discovery, entry);
+	}
+
+	return FALSE;
+}
+
+static void prv_discovery_schedule(rsu_discovery_t *discovery)
+{
+	/* Announcements are released from an idle handler so that we
+	   never emit resource-available from within one of its own
+	   handlers. */
+
+	if (!discovery->pump_id)
+		discovery->pump_id = g_idle_add(prv_discovery_pump, discovery);
+}
+
+static void prv_resource_available_cb(GSSDPResourceBrowser *browser,
+				      const char *usn, GList *locations,
+				      gpointer user_data)
+{
+	rsu_discovery_t *discovery = user_data;
+	GUPnPControlPoint *cp = GUPNP_CONTROL_POINT(browser);
+	rsu_discovery_entry_t *entry;
+
+	if (discovery->releasing)
+		goto on_error;
+
+	g_signal_stop_emission_by_name(cp, "resource-available");
+
+	if (prv_discovery_pending(discovery, cp, usn))
+		goto on_error;
+
+	entry = prv_discovery_entry_new(discovery, cp, usn, locations);
+
+	/* The descriptions of renderers denied by UDN are not downloaded.
+	   Their announcements are set aside, as the browser will not
+	   report them again, in case the filter is changed. */
+
+	if (!rsu_filter_allow_udn(discovery->filter, entry->udn))
+		g_queue_push_tail(&discovery->denied, entry);
+	else if (g_hash_table_lookup_extended(discovery->known, entry->udn,
+					      NULL, NULL))
+		g_queue_push_tail(&discovery->known_queue, entry);
+	else
+		g_queue_push_tail(&discovery->queue, entry);
+
+	prv_discovery_schedule(discovery);
+
+on_error:
+
+	return;
+}
+
+static void prv_resource_unavailable_cb(GSSDPResourceBrowser *browser,
+					const char *usn, gpointer user_data)
+{
+	rsu_discovery_t *discovery = user_data;
+	GUPnPControlPoint *cp = GUPNP_CONTROL_POINT(browser);
+	rsu_discovery_entry_t *entry;
+	GList *link;
+	unsigned int i;
+
+	link = prv_discovery_find_queued(&discovery->known_queue, cp, usn);
+	if (link) {
+		prv_discovery_entry_delete(link->data);
+		g_queue_delete_link(&discovery->known_queue, link);
+	}
+
+	link = prv_discovery_find_queued(&discovery->queue, cp, usn);
+	if (link) {
+		prv_discovery_entry_delete(link->data);
+		g_queue_delete_link(&discovery->queue, link);
+	}
+
+	link = prv_discovery_find_queued(&discovery->denied, cp, usn);
+	if (link) {
+		prv_discovery_entry_delete(link->data);
+		g_queue_delete_link(&discovery->denied, link);
+	}
+
+	for (i = 0; i < discovery->fetching->len; ++i) {
+		entry = g_ptr_array_index(discovery->fetching, i);
+
+		if (prv_discovery_entry_match(entry, cp, usn)) {
+			(void) g_ptr_array_remove_index_fast(
+				discovery->fetching, i);
+			prv_discovery_entry_delete(entry);
+			prv_discovery_schedule(discovery);
+			break;
+		}
+	}
+}
+
+static void prv_discovery_purge_queue(GQueue *queue, GUPnPContext *context)
+{
+	GList *link;
+	GList *next;
+	rsu_discovery_entry_t *entry;
+
+	for (link = queue->head; link; link = next) {
+		next = link->next;
+		entry = link->data;
+
+		if (gupnp_control_point_get_context(entry->cp) == context) {
+			prv_discovery_entry_delete(entry);
+			g_queue_delete_link(queue, link);
+		}
+	}
+}
+
+void rsu_discovery_new(const rsu_settings_t *settings, rsu_filter_t *filter,
+		       rsu_discovery_t **discovery)
+{
+	rsu_discovery_t *d = g_new0(rsu_discovery_t, 1);
+
+	d->filter = filter;
+	d->max_fetches = settings->max_fetches;
+	d->fetch_timeout = settings->fetch_timeout;
+	g_queue_init(&d->known_queue);
+	g_queue_init(&d->queue);
+	g_queue_init(&d->denied);
+	d->fetching = g_ptr_array_new();
+	d->known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					 NULL);
+
+	*discovery = d;
+}
+
+void rsu_discovery_delete(rsu_discovery_t *discovery)
+{
+	rsu_discovery_entry_t *entry;
+	unsigned int i;
+
+	if (discovery) {
+		if (discovery->pump_id)
+			(void) g_source_remove(discovery->pump_id);
+
+		while ((entry = g_queue_pop_head(&discovery->known_queue)))
+			prv_discovery_entry_delete(entry);
+
+		while ((entry = g_queue_pop_head(&discovery->queue)))
+			prv_discovery_entry_delete(entry);
+
+		while ((entry = g_queue_pop_head(&discovery->denied)))
+			prv_discovery_entry_delete(entry);
+
+		for (i = 0; i < discovery->fetching->len; ++i)
+			prv_discovery_entry_delete(
+				g_ptr_array_index(discovery->fetching, i));
+		g_ptr_array_unref(discovery->fetching);
+
+		g_hash_table_unref(discovery->known);
+		g_free(discovery);
+	}
+}
+
+void rsu_discovery_watch(rsu_discovery_t *discovery, GUPnPControlPoint *cp)
+{
+	g_signal_connect(cp, "resource-available",
+			 G_CALLBACK(prv_resource_available_cb), discovery);
+	g_signal_connect(cp, "resource-unavailable",
+			 G_CALLBACK(prv_resource_unavailable_cb), discovery);
+}
+
+void rsu_discovery_context_unavailable(rsu_discovery_t *discovery,
+				       GUPnPContext *context)
+{
+	rsu_discovery_entry_t *entry;
+	unsigned int i = 0;
+
+	prv_discovery_purge_queue(&discovery->known_queue, context);
+	prv_discovery_purge_queue(&discovery->queue, context);
+	prv_discovery_purge_queue(&discovery->denied, context);
+
+	while (i < discovery->fetching->len) {
+		entry = g_ptr_array_index(discovery->fetching, i);
+
+		if (gupnp_control_point_get_context(entry->cp) == context) {
+			(void) g_ptr_array_remove_index_fast(
+				discovery->fetching, i);
+			prv_discovery_entry_delete(entry);
+		} else {
+			++i;
+		}
+	}
+
+	prv_discovery_schedule(discovery);
+}
+
+static void prv_discovery_deny_queued(rsu_discovery_t *discovery,
+				      GQueue *queue)
+{
+	GList *link;
+	GList *next;
+	rsu_discovery_entry_t *entry;
+
+	for (link = queue->head; link; link = next) {
+		next = link->next;
+		entry = link->data;
+
+		if (!rsu_filter_allow_udn(discovery->filter, entry->udn)) {
+			g_queue_unlink(queue, link);
+			g_queue_push_tail_link(&discovery->denied, link);
+		}
+	}
+}
+
+/* Called when the filter has changed.  Announcements that were set
+   aside are released if their renderers are now allowed, and queued
+   announcements of renderers that are now denied are set aside. */
+
+void rsu_discovery_filter_changed(rsu_discovery_t *discovery)
+{
+	GList *link;
+	GList *next;
+	rsu_discovery_entry_t *entry;
+	GQueue *queue;
+
+	prv_discovery_deny_queued(discovery, &discovery->known_queue);
+	prv_discovery_deny_queued(discovery, &discovery->queue);
+
+	for (link = discovery->denied.head; link; link = next) {
+		next = link->next;
+		entry = link->data;
+
+		if (!rsu_filter_allow_udn(discovery->filter, entry->udn))
+			queue = NULL;
+		else if (g_hash_table_lookup_extended(discovery->known,
+						      entry->udn, NULL, NULL))
+			queue = &discovery->known_queue;
+		else
+			queue = &discovery->queue;
+
+		if (queue) {
+			entry->announced = g_get_monotonic_time();
+			g_queue_unlink(&discovery->denied, link);
+			g_queue_push_tail_link(queue, link);
+		}
+	}
+
+	prv_discovery_schedule(discovery);
+}
+
+void rsu_discovery_add_known(rsu_discovery_t *discovery, const gchar *udn)
+{
+	g_hash_table_replace(discovery->known, g_strdup(udn), NULL);
+}
+
+void rsu_discovery_device_found(rsu_discovery_t *discovery,
+				GUPnPControlPoint *cp, const gchar *udn)
+{
+	rsu_discovery_entry_t *entry;
+	unsigned int i;
+	gint64 now = g_get_monotonic_time();
+
+	rsu_discovery_add_known(discovery, udn);
+
+	for (i = 0; i < discovery->fetching->len; ++i) {
+		entry = g_ptr_array_index(discovery->fetching, i);
+
+		if (entry->cp == cp && !strcmp(entry->udn, udn))
+			break;
+	}
+
+	if (i == discovery->fetching->len)
+		goto on_error;
+
+	g_debug("Renderer %s available: %.3f s from SSDP to description"
+		" request, %.3f s from description request to FoundServer",
+		udn,
+		(entry->fetch_start - entry->announced) / 1000000.0,
+		(now - entry->fetch_start) / 1000000.0);
+
+	(void) g_ptr_array_remove_index_fast(discovery->fetching, i);
+	prv_discovery_entry_delete(entry);
+	prv_discovery_schedule(discovery);
+
+on_error:
+
+	return;
+}
@@ -0,0 +1,44 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef RSU_DISCOVERY_H__
+#define RSU_DISCOVERY_H__
+
+#include <libgupnp/gupnp-control-point.h>
+
+#include "settings.h"
+#include "filter.h"
+
+typedef struct rsu_discovery_t_ rsu_discovery_t;
+
+void rsu_discovery_new(const rsu_settings_t *settings, rsu_filter_t *filter,
+		       rsu_discovery_t **discovery);
+void rsu_discovery_delete(rsu_discovery_t *discovery);
+void rsu_discovery_watch(rsu_discovery_t *discovery, GUPnPControlPoint *cp);
+void rsu_discovery_context_unavailable(rsu_discovery_t *discovery,
+				       GUPnPContext *context);
+void rsu_discovery_filter_changed(rsu_discovery_t *discovery);
+void rsu_discovery_add_known(rsu_discovery_t *discovery, const gchar *udn);
+void rsu_discovery_device_found(rsu_discovery_t *discovery,
+				GUPnPControlPoint *cp, const gchar *udn);
+
+#endif
@@ -42,7 +42,9 @@ static const GDBusErrorEntry g_error_entries[] = {
 	{ RSU_ERROR_NOT_SUPPORTED, RSU_SERVICE".NotSupported" },
 	{ RSU_ERROR_LOST_OBJECT, RSU_SERVICE".LostObject" },
 	{ RSU_ERROR_BAD_MIME, RSU_SERVICE".BadMime" },
-	{ RSU_ERROR_HOST_FAILED, RSU_SERVICE".HostFailed" }
+	{ RSU_ERROR_HOST_FAILED, RSU_SERVICE".HostFailed" },
+	{ RSU_ERROR_TIMEOUT, RSU_SERVICE".Timeout" },
+	{ RSU_ERROR_BUSY, RSU_SERVICE".Busy" }
 };
 
 GQuark rsu_error_quark(void)
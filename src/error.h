@@ -37,7 +37,9 @@ enum rsu_error_t_ {
 	RSU_ERROR_NOT_SUPPORTED,
 	RSU_ERROR_LOST_OBJECT,
 	RSU_ERROR_BAD_MIME,
-	RSU_ERROR_HOST_FAILED
+	RSU_ERROR_HOST_FAILED,
+	RSU_ERROR_TIMEOUT,
+	RSU_ERROR_BUSY
 };
 typedef enum rsu_error_ rsu_error_t;
 
@@ -0,0 +1,394 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "filter.h"
+#include "error.h"
+
+enum rsu_filter_list_t_ {
+	RSU_FILTER_INTERFACES,
+	RSU_FILTER_SUBNETS,
+	RSU_FILTER_ALLOW_UDNS,
+	RSU_FILTER_DENY_UDNS,
+	RSU_FILTER_ALLOW_MANUFACTURERS,
+	RSU_FILTER_DENY_MANUFACTURERS,
+	RSU_FILTER_ALLOW_MODELS,
+	RSU_FILTER_DENY_MODELS,
+	RSU_FILTER_MAX
+};
+typedef enum rsu_filter_list_t_ rsu_filter_list_t;
+
+static const gchar *g_filter_keys[RSU_FILTER_MAX] = {
+	"Interfaces",
+	"Subnets",
+	"AllowUDNs",
+	"DenyUDNs",
+	"AllowManufacturers",
+	"DenyManufacturers",
+	"AllowModels",
+	"DenyModels"
+};
+
+typedef struct rsu_filter_subnet_t_ rsu_filter_subnet_t;
+struct rsu_filter_subnet_t_ {
+	guint8 bytes[16];
+	gsize size;
+	guint prefix;
+};
+
+struct rsu_filter_t_ {
+	gchar **lists[RSU_FILTER_MAX];
+	GArray *subnets;
+};
+
+static gboolean prv_subnet_parse(const gchar *str,
+				 rsu_filter_subnet_t *subnet)
+{
+	gchar **parts;
+	GInetAddress *address = NULL;
+	gchar *end;
+	gulong prefix;
+	gboolean retval = FALSE;
+
+	parts = g_strsplit(str, "/", 2);
+
+	address = g_inet_address_new_from_string(parts[0]);
+	if (!address)
+		goto on_error;
+
+	subnet->size = g_inet_address_get_native_size(address);
+	memcpy(subnet->bytes, g_inet_address_to_bytes(address), subnet->size);
+	subnet->prefix = subnet->size * 8;
+
+	if (parts[1]) {
+		prefix = strtoul(parts[1], &end, 10);
+		if (end == parts[1] || *end || prefix > subnet->prefix)
+			goto on_error;
+		subnet->prefix = prefix;
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	if (address)
+		g_object_unref(address);
+	g_strfreev(parts);
+
+	return retval;
+}
+
+static gboolean prv_subnet_match(const rsu_filter_subnet_t *subnet,
+				 const guint8 *bytes, gsize size)
+{
+	guint full = subnet->prefix / 8;
+	guint rest = subnet->prefix % 8;
+	guint8 mask;
+	gboolean retval = FALSE;
+
+	if (size != subnet->size || memcmp(bytes, subnet->bytes, full))
+		goto on_error;
+
+	if (rest) {
+		mask = (0xff << (8 - rest)) & 0xff;
+		if ((bytes[full] ^ subnet->bytes[full]) & mask)
+			goto on_error;
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
+
+static gboolean prv_subnets_parse(gchar **list, GArray **subnets,
+				  GError **error)
+{
+	GArray *array;
+	rsu_filter_subnet_t subnet;
+	unsigned int i;
+	gboolean retval = TRUE;
+
+	array = g_array_new(FALSE, FALSE, sizeof(rsu_filter_subnet_t));
+
+	for (i = 0; list && list[i]; ++i) {
+		if (!prv_subnet_parse(list[i], &subnet)) {
+			*error = g_error_new(RSU_ERROR, RSU_ERROR_BAD_QUERY,
+					     "Invalid subnet %s", list[i]);
+			retval = FALSE;
+			break;
+		}
+
+		g_array_append_val(array, subnet);
+	}
+
+	if (retval)
+		*subnets = array;
+	else
+		g_array_unref(array);
+
+	return retval;
+}
+
+static gboolean prv_list_empty(gchar **list)
+{
+	return !list || !list[0];
+}
+
+static gboolean prv_list_contains(gchar **list, const gchar *value)
+{
+	unsigned int i;
+	gboolean retval = FALSE;
+
+	if (!list || !value)
+		goto on_error;
+
+	for (i = 0; list[i]; ++i) {
+		if (!g_ascii_strcasecmp(list[i], value)) {
+			retval = TRUE;
+			break;
+		}
+	}
+
+on_error:
+
+	return retval;
+}
+
+static gboolean prv_allowed(rsu_filter_t *filter, rsu_filter_list_t allow,
+			    rsu_filter_list_t deny, const gchar *value)
+{
+	return !prv_list_contains(filter->lists[deny], value) &&
+		(prv_list_empty(filter->lists[allow]) ||
+		 prv_list_contains(filter->lists[allow], value));
+}
+
+void rsu_filter_new(const rsu_settings_t *settings, rsu_filter_t **filter)
+{
+	rsu_filter_t *f = g_new0(rsu_filter_t, 1);
+	GError *error = NULL;
+
+	f->lists[RSU_FILTER_INTERFACES] = g_strdupv(settings->interfaces);
+	f->lists[RSU_FILTER_SUBNETS] = g_strdupv(settings->subnets);
+	f->lists[RSU_FILTER_ALLOW_UDNS] = g_strdupv(settings->allow_udns);
+	f->lists[RSU_FILTER_DENY_UDNS] = g_strdupv(settings->deny_udns);
+	f->lists[RSU_FILTER_ALLOW_MANUFACTURERS] =
+		g_strdupv(settings->allow_manufacturers);
+	f->lists[RSU_FILTER_DENY_MANUFACTURERS] =
+		g_strdupv(settings->deny_manufacturers);
+	f->lists[RSU_FILTER_ALLOW_MODELS] = g_strdupv(settings->allow_models);
+	f->lists[RSU_FILTER_DENY_MODELS] = g_strdupv(settings->deny_models);
+
+	if (!prv_subnets_parse(f->lists[RSU_FILTER_SUBNETS], &f->subnets,
+			       &error)) {
+		g_warning("Ignoring subnet filter: %s", error->message);
+		g_error_free(error);
+
+		g_strfreev(f->lists[RSU_FILTER_SUBNETS]);
+		f->lists[RSU_FILTER_SUBNETS] = NULL;
+		f->subnets = g_array_new(FALSE, FALSE,
+					 sizeof(rsu_filter_subnet_t));
+	}
+
+	*filter = f;
+}
+
+void rsu_filter_delete(rsu_filter_t *filter)
+{
+	unsigned int i;
+
+	if (filter) {
+		for (i = 0; i < RSU_FILTER_MAX; ++i)
+			g_strfreev(filter->lists[i]);
+		g_array_unref(filter->subnets);
+		g_free(filter);
+	}
+}
+
+gboolean rsu_filter_allow_context(rsu_filter_t *filter,
+				  GUPnPContext *context)
+{
+	const gchar *interface;
+	GInetAddress *address = NULL;
+	unsigned int i;
+	gboolean retval = FALSE;
+
+	if (!prv_list_empty(filter->lists[RSU_FILTER_INTERFACES])) {
+		interface = gssdp_client_get_interface(GSSDP_CLIENT(context));
+		if (!prv_list_contains(filter->lists[RSU_FILTER_INTERFACES],
+				       interface))
+			goto on_error;
+	}
+
+	if (filter->subnets->len) {
+		address = g_inet_address_new_from_string(
+			gupnp_context_get_host_ip(context));
+		if (!address)
+			goto on_error;
+
+		for (i = 0; i < filter->subnets->len; ++i)
+			if (prv_subnet_match(
+				    &g_array_index(filter->subnets,
+						   rsu_filter_subnet_t, i),
+				    g_inet_address_to_bytes(address),
+				    g_inet_address_get_native_size(address)))
+				break;
+
+		if (i == filter->subnets->len)
+			goto on_error;
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	if (address)
+		g_object_unref(address);
+
+	return retval;
+}
+
+gboolean rsu_filter_allow_udn(rsu_filter_t *filter, const gchar *udn)
+{
+	return prv_allowed(filter, RSU_FILTER_ALLOW_UDNS, RSU_FILTER_DENY_UDNS,
+			   udn);
+}
+
+gboolean rsu_filter_allow_device(rsu_filter_t *filter, GUPnPDeviceInfo *info)
+{
+	gchar *manufacturer = NULL;
+	gchar *model = NULL;
+	gboolean retval = FALSE;
+
+	if (!rsu_filter_allow_udn(filter, gupnp_device_info_get_udn(info)))
+		goto on_error;
+
+	manufacturer = gupnp_device_info_get_manufacturer(info);
+	if (!prv_allowed(filter, RSU_FILTER_ALLOW_MANUFACTURERS,
+			 RSU_FILTER_DENY_MANUFACTURERS, manufacturer))
+		goto on_error;
+
+	model = gupnp_device_info_get_model_name(info);
+	if (!prv_allowed(filter, RSU_FILTER_ALLOW_MODELS,
+			 RSU_FILTER_DENY_MODELS, model))
+		goto on_error;
+
+	retval = TRUE;
+
+on_error:
+
+	g_free(model);
+	g_free(manufacturer);
+
+	return retval;
+}
+
+GVariant *rsu_filter_get(rsu_filter_t *filter)
+{
+	GVariantBuilder vb;
+	gchar *empty[] = { NULL };
+	gchar **list;
+	unsigned int i;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	for (i = 0; i < RSU_FILTER_MAX; ++i) {
+		list = filter->lists[i] ? filter->lists[i] : empty;
+		g_variant_builder_add(&vb, "{sv}", g_filter_keys[i],
+				      g_variant_new_strv(
+					      (const gchar * const *) list,
+					      -1));
+	}
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+gboolean rsu_filter_set(rsu_filter_t *filter, GVariant *values,
+			GError **error)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+	GVariant *lists[RSU_FILTER_MAX] = { NULL };
+	GArray *subnets = NULL;
+	gchar **subnet_list;
+	unsigned int i;
+	gboolean retval = FALSE;
+
+	/* Validate all of the new values before changing anything so
+	   that a bad request leaves the filter untouched. */
+
+	g_variant_iter_init(&iter, values);
+
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		for (i = 0; i < RSU_FILTER_MAX; ++i)
+			if (!strcmp(key, g_filter_keys[i]))
+				break;
+
+		if (i == RSU_FILTER_MAX ||
+		    !g_variant_is_of_type(value, G_VARIANT_TYPE("as"))) {
+			*error = g_error_new(RSU_ERROR, RSU_ERROR_BAD_QUERY,
+					     "Invalid filter entry %s", key);
+			g_variant_unref(value);
+			goto on_error;
+		}
+
+		if (lists[i])
+			g_variant_unref(lists[i]);
+		lists[i] = value;
+	}
+
+	if (lists[RSU_FILTER_SUBNETS]) {
+		subnet_list = g_variant_dup_strv(lists[RSU_FILTER_SUBNETS],
+						 NULL);
+		retval = prv_subnets_parse(subnet_list, &subnets, error);
+		g_strfreev(subnet_list);
+
+		if (!retval)
+			goto on_error;
+
+		g_array_unref(filter->subnets);
+		filter->subnets = subnets;
+	}
+
+	for (i = 0; i < RSU_FILTER_MAX; ++i) {
+		if (lists[i]) {
+			g_strfreev(filter->lists[i]);
+			filter->lists[i] = g_variant_dup_strv(lists[i], NULL);
+		}
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	for (i = 0; i < RSU_FILTER_MAX; ++i)
+		if (lists[i])
+			g_variant_unref(lists[i]);
+
+	return retval;
+}
@@ -0,0 +1,42 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef RSU_FILTER_H__
+#define RSU_FILTER_H__
+
+#include <libgupnp/gupnp-control-point.h>
+
+#include "settings.h"
+
+typedef struct rsu_filter_t_ rsu_filter_t;
+
+void rsu_filter_new(const rsu_settings_t *settings, rsu_filter_t **filter);
+void rsu_filter_delete(rsu_filter_t *filter);
+gboolean rsu_filter_allow_context(rsu_filter_t *filter,
+				  GUPnPContext *context);
+gboolean rsu_filter_allow_udn(rsu_filter_t *filter, const gchar *udn);
+gboolean rsu_filter_allow_device(rsu_filter_t *filter, GUPnPDeviceInfo *info);
+GVariant *rsu_filter_get(rsu_filter_t *filter);
+gboolean rsu_filter_set(rsu_filter_t *filter, GVariant *values,
+			GError **error);
+
+#endif
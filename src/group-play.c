@@ -0,0 +1,234 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+
+#include "config.h"
+
+#include "group-play.h"
+
+/* Renderers take different amounts of time both to receive a Play
+   action and to start playing once they have received it.  To start a
+   group of renderers together, Play is sent to each renderer in turn,
+   so that the renderers with the longest lead times, half their SOAP
+   round trip time plus the time they were last seen to take to start,
+   receive it first.
+
+   The time at which each renderer actually started is then estimated
+   from a number of position reports.  Each report bounds the time at
+   which the renderer would have been at position 0: no earlier than
+   the time the request was sent less the position, less the
+   resolution of the position, and no later than the time the response
+   was received less the position.  The bounds of successive reports
+   are intersected.  The skew of the group is the spread of these
+   estimates. */
+
+#define RSU_GROUP_PLAY_MAX_LEAD (2 * G_USEC_PER_SEC)
+#define RSU_GROUP_PLAY_RESOLUTION G_USEC_PER_SEC
+
+typedef struct rsu_group_play_renderer_t_ rsu_group_play_renderer_t;
+struct rsu_group_play_renderer_t_ {
+	gboolean excluded;
+	gint64 rtt;
+	gint64 lead;
+	gint64 send_time;
+	gboolean sent;
+	gint64 sent_time;
+	gboolean sampled;
+	gint64 lower;
+	gint64 upper;
+};
+
+struct rsu_group_play_t_ {
+	guint count;
+	rsu_group_play_renderer_t *renderers;
+};
+
+void rsu_group_play_new(guint count, rsu_group_play_t **play)
+{
+	rsu_group_play_t *p = g_new0(rsu_group_play_t, 1);
+
+	p->count = count;
+	p->renderers = g_new0(rsu_group_play_renderer_t, count);
+
+	*play = p;
+}
+
+void rsu_group_play_delete(rsu_group_play_t *play)
+{
+	if (play) {
+		g_free(play->renderers);
+		g_free(play);
+	}
+}
+
+void rsu_group_play_set_latency(rsu_group_play_t *play, guint index,
+				gint64 rtt, gint64 start_latency)
+{
+	rsu_group_play_renderer_t *r = &play->renderers[index];
+
+	r->rtt = CLAMP(rtt, 0, 2 * RSU_GROUP_PLAY_MAX_LEAD);
+	r->lead = CLAMP(r->rtt / 2 + start_latency, 0,
+			RSU_GROUP_PLAY_MAX_LEAD);
+}
+
+void rsu_group_play_exclude(rsu_group_play_t *play, guint index)
+{
+	play->renderers[index].excluded = TRUE;
+}
+
+gboolean rsu_group_play_is_excluded(rsu_group_play_t *play, guint index)
+{
+	return play->renderers[index].excluded;
+}
+
+void rsu_group_play_schedule(rsu_group_play_t *play, gint64 now)
+{
+	rsu_group_play_renderer_t *r;
+	gint64 max_lead = 0;
+	unsigned int i;
+
+	for (i = 0; i < play->count; ++i) {
+		r = &play->renderers[i];
+		if (!r->excluded && r->lead > max_lead)
+			max_lead = r->lead;
+	}
+
+	for (i = 0; i < play->count; ++i) {
+		r = &play->renderers[i];
+		r->send_time = now + max_lead - r->lead;
+		r->sent = FALSE;
+	}
+}
+
+/* Returns the time at which Play should next be sent, and the renderer
+   to which it should be sent, or -1 if Play has been sent to all of
+   the renderers. */
+
+gint64 rsu_group_play_next_send(rsu_group_play_t *play, guint *index)
+{
+	rsu_group_play_renderer_t *r;
+	gint64 retval = -1;
+	unsigned int i;
+
+	for (i = 0; i < play->count; ++i) {
+		r = &play->renderers[i];
+		if (!r->excluded && !r->sent &&
+		    (retval == -1 || r->send_time < retval)) {
+			retval = r->send_time;
+			*index = i;
+		}
+	}
+
+	return retval;
+}
+
+void rsu_group_play_sent(rsu_group_play_t *play, guint index, gint64 time)
+{
+	play->renderers[index].sent = TRUE;
+	play->renderers[index].sent_time = time;
+}
+
+/* Renderers that report whole seconds are assumed to truncate the
+   position.  If a report is inconsistent with the earlier ones, the
+   renderer has probably stalled, so only the latest report is used. */
+
+void rsu_group_play_add_sample(rsu_group_play_t *play, guint index,
+			       gint64 sent, gint64 received,
+			       gint64 position)
+{
+	rsu_group_play_renderer_t *r = &play->renderers[index];
+	gint64 resolution;
+	gint64 lower;
+	gint64 upper;
+
+	resolution = position % G_USEC_PER_SEC ? 0 :
+		RSU_GROUP_PLAY_RESOLUTION;
+	lower = sent - position - resolution;
+	upper = received - position;
+
+	if (r->sampled && MAX(r->lower, lower) <= MIN(r->upper, upper)) {
+		r->lower = MAX(r->lower, lower);
+		r->upper = MIN(r->upper, upper);
+	} else {
+		r->lower = lower;
+		r->upper = upper;
+		r->sampled = TRUE;
+	}
+}
+
+static gint64 prv_group_play_start(rsu_group_play_renderer_t *r)
+{
+	return r->lower + (r->upper - r->lower) / 2;
+}
+
+/* Returns the difference, in microseconds, between the start times of
+   the first and the last renderers to start, or -1 if fewer than two
+   renderers could be measured. */
+
+gint64 rsu_group_play_get_skew(rsu_group_play_t *play)
+{
+	rsu_group_play_renderer_t *r;
+	gint64 start;
+	gint64 first = 0;
+	gint64 last = 0;
+	guint measured = 0;
+	unsigned int i;
+
+	for (i = 0; i < play->count; ++i) {
+		r = &play->renderers[i];
+		if (r->excluded || !r->sampled)
+			continue;
+
+		start = prv_group_play_start(r);
+		if (!measured || start < first)
+			first = start;
+		if (!measured || start > last)
+			last = start;
+		++measured;
+	}
+
+	return measured < 2 ? -1 : last - first;
+}
+
+/* Returns the time the renderer took to start playing from position
+   once Play had reached it. */
+
+gboolean rsu_group_play_get_start_latency(rsu_group_play_t *play,
+					  guint index, gint64 position,
+					  gint64 *latency)
+{
+	rsu_group_play_renderer_t *r = &play->renderers[index];
+	gboolean retval = FALSE;
+
+	if (r->excluded || !r->sent || !r->sampled)
+		goto on_error;
+
+	*latency = prv_group_play_start(r) + position -
+		(r->sent_time + r->rtt / 2);
+	*latency = CLAMP(*latency, 0, RSU_GROUP_PLAY_MAX_LEAD);
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
@@ -0,0 +1,48 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+#ifndef RSU_GROUP_PLAY_H__
+#define RSU_GROUP_PLAY_H__
+
+#include <glib.h>
+
+typedef struct rsu_group_play_t_ rsu_group_play_t;
+
+void rsu_group_play_new(guint count, rsu_group_play_t **play);
+void rsu_group_play_delete(rsu_group_play_t *play);
+void rsu_group_play_set_latency(rsu_group_play_t *play, guint index,
+				gint64 rtt, gint64 start_latency);
+void rsu_group_play_exclude(rsu_group_play_t *play, guint index);
+gboolean rsu_group_play_is_excluded(rsu_group_play_t *play, guint index);
+void rsu_group_play_schedule(rsu_group_play_t *play, gint64 now);
+gint64 rsu_group_play_next_send(rsu_group_play_t *play, guint *index);
+void rsu_group_play_sent(rsu_group_play_t *play, guint index, gint64 time);
+void rsu_group_play_add_sample(rsu_group_play_t *play, guint index,
+			       gint64 sent, gint64 received,
+			       gint64 position);
+gint64 rsu_group_play_get_skew(rsu_group_play_t *play);
+gboolean rsu_group_play_get_start_latency(rsu_group_play_t *play,
+					  guint index, gint64 position,
+					  gint64 *latency);
+
+#endif
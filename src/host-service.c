@@ -23,15 +23,46 @@
 #include "config.h"
 
 #include <libsoup/soup.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "host-service.h"
 #include "error.h"
 
 #define HOST_SERVICE_ROOT "/rendererserviceupnp"
+#define HOST_SERVICE_METRICS HOST_SERVICE_ROOT"/metrics"
+
+#define HOST_SERVICE_SCALE_MIME "image/jpeg"
+#define HOST_SERVICE_SCALE_THREADS 1
+#define HOST_SERVICE_SCALE_QUALITY "90"
+#define HOST_SERVICE_SCALE_CACHE "images"
+#define HOST_SERVICE_SCALE_CACHE_SIZE (64 * 1024 * 1024)
+#define HOST_SERVICE_SCALE_CACHE_AGE (30 * 24 * 60 * 60)
+
+#define HOST_SERVICE_FANOUT_CHUNK (64 * 1024)
+#define HOST_SERVICE_FANOUT_WINDOW 32
+
+#define HOST_SERVICE_MAX_RENDERERS 64
+
+typedef struct rsu_host_stats_t_ rsu_host_stats_t;
+struct rsu_host_stats_t_ {
+	guint64 bytes_sent;
+	guint requests;
+	guint active;
+	guint64 latency;
+	guint latency_samples;
+	guint64 transfer_time;
+	gint64 last_request;
+};
 
+typedef struct rsu_host_fanout_t_ rsu_host_fanout_t;
 typedef struct rsu_host_file_t_ rsu_host_file_t;
 struct rsu_host_file_t_ {
 	unsigned int id;
@@ -40,6 +71,44 @@ struct rsu_host_file_t_ {
 	GMappedFile *mapped_file;
 	unsigned int mapped_count;
 	gchar *path;
+	rsu_host_stats_t stats;
+	GPtrArray *transfers;
+	GHashTable *variants;
+	GHashTable *renderer_variants;
+	rsu_host_fanout_t *fanout;
+};
+
+/* Shared read state for all the renderers currently downloading the
+   original of a hosted file in fan-out mode.  chunks holds a sliding
+   window of the last HOST_SERVICE_FANOUT_WINDOW chunks read from disk,
+   covering the byte range [base, end).  Each chunk is read once by
+   the fastest renderer and then appended, by reference, to the
+   response bodies of all the others.  Renderers that fall behind base
+   are served from mapped_file instead. */
+
+struct rsu_host_fanout_t_ {
+	rsu_host_file_t *file;
+	unsigned int readers;
+	gchar *path;
+	int fd;
+	goffset size;
+	goffset base;
+	goffset end;
+	GQueue chunks;
+	GMappedFile *mapped_file;
+};
+
+/* A downscaled copy of a hosted image.  Variants are shared by all the
+   renderers whose largest supported image profile has the same
+   dimensions.  path is NULL until the scaled image is ready, and
+   remains NULL if the original image did not need to be scaled. */
+
+typedef struct rsu_host_variant_t_ rsu_host_variant_t;
+struct rsu_host_variant_t_ {
+	guint width;
+	guint height;
+	gchar *path;
+	GMappedFile *mapped_file;
 };
 
 typedef struct rsu_host_server_t_ rsu_host_server_t;
@@ -47,12 +116,79 @@ struct rsu_host_server_t_ {
 	GHashTable *files;
 	SoupServer *soup_server;
 	unsigned int counter;
+	rsu_host_service_t *service;
 };
 
 struct rsu_host_service_t_ {
 	GHashTable *servers;
+	GHashTable *renderers;
+	gboolean scale_images;
+	gboolean fan_out;
+	GThreadPool *scale_pool;
+	GPtrArray *scale_jobs;
+	GPtrArray *lookups;
+	GCancellable *cancellable;
 };
 
+/* Resolves the host name by which a renderer is known to the
+   addresses from which it will download a hosted image. */
+
+typedef struct rsu_host_lookup_t_ rsu_host_lookup_t;
+struct rsu_host_lookup_t_ {
+	rsu_host_service_t *service;
+	gchar *device_if;
+	gchar *file;
+	gchar *key;
+};
+
+typedef struct rsu_host_cache_entry_t_ rsu_host_cache_entry_t;
+struct rsu_host_cache_entry_t_ {
+	gchar *path;
+	gint64 mtime;
+	gint64 size;
+};
+
+typedef struct rsu_host_transfer_t_ rsu_host_transfer_t;
+struct rsu_host_transfer_t_ {
+	rsu_host_file_t *file;
+	rsu_host_stats_t *renderer;
+	gint64 start;
+	gint64 first_byte;
+	GMappedFile *variant;
+	rsu_host_fanout_t *fanout;
+	goffset offset;
+};
+
+typedef struct rsu_host_scale_job_t_ rsu_host_scale_job_t;
+struct rsu_host_scale_job_t_ {
+	rsu_host_service_t *service;
+	gchar *device_if;
+	gchar *file;
+	gchar *key;
+	guint width;
+	guint height;
+	gchar *cache_path;
+	gboolean scaled;
+	gboolean done;
+};
+
+static void prv_detach_transfer(gpointer transfer, gpointer user_data)
+{
+	((rsu_host_transfer_t *) transfer)->file = NULL;
+}
+
+static void prv_host_variant_delete(gpointer host_variant)
+{
+	rsu_host_variant_t *variant = host_variant;
+
+	if (variant) {
+		if (variant->mapped_file)
+			g_mapped_file_unref(variant->mapped_file);
+		g_free(variant->path);
+		g_free(variant);
+	}
+}
+
 static void prv_host_file_delete(gpointer host_file)
 {
 	rsu_host_file_t *hf = host_file;
@@ -65,6 +201,18 @@ static void prv_host_file_delete(gpointer host_file)
 
 		g_ptr_array_unref(hf->clients);
 
+		/* Transfers may outlive the file if it is removed while
+		   a renderer is still downloading it. */
+
+		g_ptr_array_foreach(hf->transfers, prv_detach_transfer, NULL);
+		g_ptr_array_unref(hf->transfers);
+
+		if (hf->fanout)
+			hf->fanout->file = NULL;
+
+		g_hash_table_unref(hf->renderer_variants);
+		g_hash_table_unref(hf->variants);
+
 		g_free(hf->mime_type);
 		g_free(hf);
 	}
@@ -87,6 +235,11 @@ static rsu_host_file_t *prv_host_file_new(const gchar *file, unsigned int id,
 	hf = g_new0(rsu_host_file_t, 1);
 	hf->id = id;
 	hf->clients = g_ptr_array_new_with_free_func(g_free);
+	hf->transfers = g_ptr_array_new();
+	hf->variants = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, prv_host_variant_delete);
+	hf->renderer_variants = g_hash_table_new_full(g_str_hash, g_str_equal,
+						      g_free, NULL);
 
 	content_type = g_content_type_guess(file, NULL, 0, NULL);
 
@@ -155,17 +308,390 @@ static rsu_host_file_t *prv_host_server_find_file(rsu_host_server_t *hs,
 	return retval;
 }
 
+static void prv_host_fanout_unref(rsu_host_fanout_t *fanout)
+{
+	SoupBuffer *chunk;
+
+	if (--fanout->readers > 0)
+		goto on_error;
+
+	if (fanout->file)
+		fanout->file->fanout = NULL;
+
+	while ((chunk = g_queue_pop_head(&fanout->chunks)))
+		soup_buffer_free(chunk);
+
+	if (fanout->mapped_file)
+		g_mapped_file_unref(fanout->mapped_file);
+
+	(void) close(fanout->fd);
+	g_free(fanout->path);
+	g_free(fanout);
+
+on_error:
+
+	return;
+}
+
+static rsu_host_fanout_t *prv_host_file_fanout(rsu_host_file_t *hf,
+					       const gchar *file_name)
+{
+	rsu_host_fanout_t *fanout = hf->fanout;
+	GStatBuf buf;
+	int fd = -1;
+
+	if (fanout)
+		goto done;
+
+	fd = g_open(file_name, O_RDONLY, 0);
+	if (fd == -1)
+		goto on_error;
+
+	if (fstat(fd, &buf) == -1)
+		goto on_error;
+
+	fanout = g_new0(rsu_host_fanout_t, 1);
+	fanout->file = hf;
+	fanout->path = g_strdup(file_name);
+	fanout->fd = fd;
+	fanout->size = buf.st_size;
+	g_queue_init(&fanout->chunks);
+
+	hf->fanout = fanout;
+
+done:
+
+	++fanout->readers;
+
+	return fanout;
+
+on_error:
+
+	if (fd != -1)
+		(void) close(fd);
+
+	return NULL;
+}
+
+static gboolean prv_host_fanout_read_chunk(rsu_host_fanout_t *fanout)
+{
+	gsize length;
+	gchar *data;
+	SoupBuffer *chunk;
+	gboolean retval = FALSE;
+
+	length = MIN(HOST_SERVICE_FANOUT_CHUNK, fanout->size - fanout->end);
+	data = g_malloc(length);
+
+	if (pread(fanout->fd, data, length, fanout->end) != (ssize_t) length) {
+		g_free(data);
+		goto on_error;
+	}
+
+	g_queue_push_tail(&fanout->chunks,
+			  soup_buffer_new(SOUP_MEMORY_TAKE, data, length));
+	fanout->end += length;
+
+	if (g_queue_get_length(&fanout->chunks) > HOST_SERVICE_FANOUT_WINDOW) {
+		chunk = g_queue_pop_head(&fanout->chunks);
+		fanout->base += chunk->length;
+		soup_buffer_free(chunk);
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
+
+static SoupBuffer *prv_host_fanout_get_chunk(rsu_host_fanout_t *fanout,
+					     goffset offset)
+{
+	SoupBuffer *retval = NULL;
+	gsize length;
+	gchar *contents;
+
+	/* The renderer at the head of the window reads the next chunk
+	   for everyone else. */
+
+	if (offset >= fanout->base && offset == fanout->end)
+		if (!prv_host_fanout_read_chunk(fanout))
+			goto slow_reader;
+
+	if (offset >= fanout->base && offset < fanout->end) {
+		retval = g_queue_peek_nth(&fanout->chunks,
+					  (offset - fanout->base) /
+					  HOST_SERVICE_FANOUT_CHUNK);
+		retval = soup_buffer_copy(retval);
+		goto on_error;
+	}
+
+slow_reader:
+
+	/* This renderer has fallen out of the shared window.  It
+	   continues with its own reads from the mapped file. */
+
+	if (!fanout->mapped_file) {
+		fanout->mapped_file = g_mapped_file_new(fanout->path, FALSE,
+							NULL);
+		if (!fanout->mapped_file)
+			goto on_error;
+	}
+
+	if ((goffset) g_mapped_file_get_length(fanout->mapped_file) <
+	    fanout->size)
+		goto on_error;
+
+	length = MIN(HOST_SERVICE_FANOUT_CHUNK, fanout->size - offset);
+	contents = g_mapped_file_get_contents(fanout->mapped_file);
+	retval = soup_buffer_new_with_owner(
+		contents + offset, length,
+		g_mapped_file_ref(fanout->mapped_file),
+		(GDestroyNotify) g_mapped_file_unref);
+
+on_error:
+
+	return retval;
+}
+
+static void prv_host_fanout_feed(SoupMessage *msg,
+				 rsu_host_transfer_t *transfer)
+{
+	SoupBuffer *chunk = NULL;
+
+	if (transfer->offset < transfer->fanout->size)
+		chunk = prv_host_fanout_get_chunk(transfer->fanout,
+						  transfer->offset);
+
+	/* If the file cannot be read the response is left short of its
+	   Content-Length, so the renderer will detect the error. */
+
+	if (!chunk) {
+		soup_message_body_complete(msg->response_body);
+		goto on_error;
+	}
+
+	transfer->offset += chunk->length;
+	soup_message_body_append_buffer(msg->response_body, chunk);
+	soup_buffer_free(chunk);
+
+on_error:
+
+	return;
+}
+
+static void prv_soup_message_wrote_chunk_cb(SoupMessage *msg,
+					    gpointer user_data)
+{
+	prv_host_fanout_feed(msg, user_data);
+}
+
+static void prv_start_fanout(SoupMessage *msg, rsu_host_transfer_t *transfer,
+			     rsu_host_fanout_t *fanout, const gchar *mime_type)
+{
+	transfer->fanout = fanout;
+
+	soup_message_headers_set_encoding(msg->response_headers,
+					  SOUP_ENCODING_CONTENT_LENGTH);
+	soup_message_headers_set_content_length(msg->response_headers,
+						fanout->size);
+	soup_message_headers_set_content_type(msg->response_headers,
+					      mime_type, NULL);
+	soup_message_body_set_accumulate(msg->response_body, FALSE);
+
+	g_signal_connect(msg, "wrote-chunk",
+			 G_CALLBACK(prv_soup_message_wrote_chunk_cb), transfer);
+
+	prv_host_fanout_feed(msg, transfer);
+}
+
+static void prv_soup_message_wrote_body_data_cb(SoupMessage *msg,
+						SoupBuffer *chunk,
+						gpointer user_data)
+{
+	rsu_host_transfer_t *transfer = user_data;
+	rsu_host_file_t *hf = transfer->file;
+	gint64 latency;
+
+	if (!transfer->first_byte) {
+		transfer->first_byte = g_get_monotonic_time();
+		latency = transfer->first_byte - transfer->start;
+
+		transfer->renderer->latency += latency;
+		++transfer->renderer->latency_samples;
+
+		if (hf) {
+			hf->stats.latency += latency;
+			++hf->stats.latency_samples;
+		}
+	}
+
+	transfer->renderer->bytes_sent += chunk->length;
+	if (hf)
+		hf->stats.bytes_sent += chunk->length;
+}
+
 static void prv_soup_message_finished_cb(SoupMessage *msg, gpointer user_data)
 {
-	rsu_host_file_t *hf = user_data;
+	rsu_host_transfer_t *transfer = user_data;
+	rsu_host_file_t *hf = transfer->file;
+	gint64 duration = 0;
+
+	if (transfer->first_byte)
+		duration = g_get_monotonic_time() - transfer->first_byte;
 
-	if (hf->mapped_count > 0) {
+	--transfer->renderer->active;
+	transfer->renderer->transfer_time += duration;
+
+	if (transfer->variant) {
+		g_mapped_file_unref(transfer->variant);
+	} else if (transfer->fanout) {
+		prv_host_fanout_unref(transfer->fanout);
+	} else if (hf && hf->mapped_count > 0) {
 		g_mapped_file_unref(hf->mapped_file);
 		--hf->mapped_count;
 
 		if (hf->mapped_count == 0)
 			hf->mapped_file = NULL;
 	}
+
+	if (hf) {
+		--hf->stats.active;
+		hf->stats.transfer_time += duration;
+		(void) g_ptr_array_remove_fast(hf->transfers, transfer);
+	}
+
+	g_free(transfer);
+}
+
+/* Any host on the network can download hosted files, so the number of
+   renderers we keep statistics for is limited.  The renderer that has
+   been idle for the longest is forgotten to make room for a new one.
+   Renderers with transfers in progress are never forgotten. */
+
+static void prv_expire_renderer_stats(rsu_host_service_t *host_service)
+{
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	rsu_host_stats_t *stats;
+	gpointer oldest = NULL;
+	gint64 oldest_request = G_MAXINT64;
+
+	g_hash_table_iter_init(&iter, host_service->renderers);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		stats = value;
+
+		if (!stats->active && stats->last_request < oldest_request) {
+			oldest = key;
+			oldest_request = stats->last_request;
+		}
+	}
+
+	if (oldest)
+		(void) g_hash_table_remove(host_service->renderers, oldest);
+}
+
+static rsu_host_stats_t *prv_renderer_stats(rsu_host_service_t *host_service,
+					    const gchar *renderer)
+{
+	rsu_host_stats_t *stats;
+
+	stats = g_hash_table_lookup(host_service->renderers, renderer);
+
+	if (!stats) {
+		if (g_hash_table_size(host_service->renderers) >=
+		    HOST_SERVICE_MAX_RENDERERS)
+			prv_expire_renderer_stats(host_service);
+
+		stats = g_new0(rsu_host_stats_t, 1);
+		g_hash_table_insert(host_service->renderers,
+				    g_strdup(renderer), stats);
+	}
+
+	return stats;
+}
+
+static rsu_host_transfer_t *prv_start_transfer(rsu_host_server_t *hs,
+					       rsu_host_file_t *hf,
+					       SoupMessage *msg,
+					       const gchar *renderer,
+					       GMappedFile *variant)
+{
+	rsu_host_transfer_t *transfer;
+
+	transfer = g_new0(rsu_host_transfer_t, 1);
+	transfer->file = hf;
+	transfer->variant = variant;
+	transfer->renderer = prv_renderer_stats(hs->service, renderer);
+	transfer->start = g_get_monotonic_time();
+
+	++transfer->renderer->requests;
+	++transfer->renderer->active;
+	transfer->renderer->last_request = transfer->start;
+	++hf->stats.requests;
+	++hf->stats.active;
+	g_ptr_array_add(hf->transfers, transfer);
+
+	g_signal_connect(msg, "wrote-body-data",
+			 G_CALLBACK(prv_soup_message_wrote_body_data_cb),
+			 transfer);
+	g_signal_connect(msg, "finished",
+			 G_CALLBACK(prv_soup_message_finished_cb), transfer);
+
+	return transfer;
+}
+
+/* Addresses are converted to a canonical form so that the address
+   of the HTTP peer matches the one the variant was registered under.
+   Strings that cannot be parsed, such as scoped IPv6 addresses, are
+   used as they are. */
+
+static gchar *prv_address_key(const gchar *host)
+{
+	GInetAddress *address;
+	gchar *retval;
+
+	address = g_inet_address_new_from_string(host);
+
+	if (address) {
+		retval = g_inet_address_to_string(address);
+		g_object_unref(address);
+	} else {
+		retval = g_strdup(host);
+	}
+
+	return retval;
+}
+
+static GMappedFile *prv_host_file_map_variant(rsu_host_file_t *hf,
+					      const gchar *renderer)
+{
+	rsu_host_variant_t *variant;
+	GMappedFile *retval = NULL;
+	gchar *key;
+
+	key = prv_address_key(renderer);
+	variant = g_hash_table_lookup(hf->renderer_variants, key);
+	g_free(key);
+
+	if (!variant || !variant->path)
+		goto on_error;
+
+	if (!variant->mapped_file) {
+		variant->mapped_file = g_mapped_file_new(variant->path, FALSE,
+							 NULL);
+		if (!variant->mapped_file)
+			goto on_error;
+	}
+
+	retval = g_mapped_file_ref(variant->mapped_file);
+
+on_error:
+
+	return retval;
 }
 
 static void prv_soup_server_cb(SoupServer *server, SoupMessage *msg,
@@ -175,7 +701,12 @@ static void prv_soup_server_cb(SoupServer *server, SoupMessage *msg,
 	rsu_host_file_t *hf;
 	rsu_host_server_t *hs = user_data;
 	const gchar *file_name;
+	const gchar *renderer;
 	SoupMessageHeaders *hdrs;
+	GMappedFile *variant;
+	GMappedFile *mapped_file = NULL;
+	rsu_host_fanout_t *fanout = NULL;
+	rsu_host_transfer_t *transfer;
 
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
@@ -189,9 +720,25 @@ static void prv_soup_server_cb(SoupServer *server, SoupMessage *msg,
 		goto on_error;
 	}
 
-	if (hf->mapped_file) {
+	/* Serve a downscaled copy of the image if one has been prepared
+	   for the requesting renderer.  The URL remains the same. */
+
+	renderer = soup_client_context_get_host(client);
+	variant = prv_host_file_map_variant(hf, renderer);
+
+	if (variant) {
+		mapped_file = variant;
+	} else if (hs->service->fan_out) {
+		fanout = prv_host_file_fanout(hf, file_name);
+
+		if (!fanout) {
+			soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+			goto on_error;
+		}
+	} else if (hf->mapped_file) {
 		g_mapped_file_ref(hf->mapped_file);
 		++hf->mapped_count;
+		mapped_file = hf->mapped_file;
 	} else {
 		hf->mapped_file = g_mapped_file_new(file_name, FALSE, NULL);
 
@@ -201,10 +748,10 @@ static void prv_soup_server_cb(SoupServer *server, SoupMessage *msg,
 		}
 
 		hf->mapped_count = 1;
+		mapped_file = hf->mapped_file;
 	}
 
-	g_signal_connect(msg, "finished",
-			 G_CALLBACK(prv_soup_message_finished_cb), hf);
+	transfer = prv_start_transfer(hs, hf, msg, renderer, variant);
 
 	g_object_get(msg, "response-headers", &hdrs, NULL);
 
@@ -215,16 +762,148 @@ static void prv_soup_server_cb(SoupServer *server, SoupMessage *msg,
 	soup_message_headers_append(hdrs, "Connection", "close");
 */
 	soup_message_set_status(msg, SOUP_STATUS_OK);
-	soup_message_set_response(msg, hf->mime_type, SOUP_MEMORY_STATIC,
-				  g_mapped_file_get_contents(hf->mapped_file),
-				  g_mapped_file_get_length(hf->mapped_file));
+
+	if (fanout)
+		prv_start_fanout(msg, transfer, fanout, hf->mime_type);
+	else
+		soup_message_set_response(
+			msg, hf->mime_type, SOUP_MEMORY_STATIC,
+			g_mapped_file_get_contents(mapped_file),
+			g_mapped_file_get_length(mapped_file));
 
 on_error:
 
 	return;
 }
 
-static rsu_host_server_t *prv_host_server_new(const gchar *device_if,
+static gchar *prv_host_file_url(rsu_host_server_t *server,
+			       const gchar *device_if, rsu_host_file_t *hf)
+{
+	return g_strdup_printf("http://%s:%d%s", device_if,
+			       soup_server_get_port(server->soup_server),
+			       hf->path);
+}
+
+static guint64 prv_stats_mean_latency(rsu_host_stats_t *stats)
+{
+	return stats->latency_samples ?
+		stats->latency / stats->latency_samples : 0;
+}
+
+static guint64 prv_stats_throughput(rsu_host_stats_t *stats)
+{
+	return stats->transfer_time ?
+		stats->bytes_sent * G_USEC_PER_SEC / stats->transfer_time : 0;
+}
+
+static void prv_append_label(GString *str, const gchar *name,
+			     const gchar *value)
+{
+	g_string_append_printf(str, "%s=\"", name);
+
+	for (; *value; ++value) {
+		if (*value == '\\' || *value == '"')
+			g_string_append_c(str, '\\');
+
+		if (*value == '\n')
+			g_string_append(str, "\\n");
+		else
+			g_string_append_c(str, *value);
+	}
+
+	g_string_append_c(str, '"');
+}
+
+static void prv_append_metric(GString *str, const gchar *kind,
+			      const gchar *metric, GString *labels,
+			      guint64 value)
+{
+	g_string_append_printf(str, "rsu_host_%s_%s{%s} %"G_GUINT64_FORMAT"\n",
+			       kind, metric, labels->str, value);
+}
+
+static void prv_append_stats(GString *str, const gchar *kind,
+			     GString *labels, rsu_host_stats_t *stats)
+{
+	prv_append_metric(str, kind, "bytes_sent", labels, stats->bytes_sent);
+	prv_append_metric(str, kind, "requests", labels, stats->requests);
+	prv_append_metric(str, kind, "active_transfers", labels,
+			  stats->active);
+	prv_append_metric(str, kind, "latency_microseconds", labels,
+			  prv_stats_mean_latency(stats));
+	prv_append_metric(str, kind, "throughput_bytes_per_second", labels,
+			  prv_stats_throughput(stats));
+}
+
+static gchar *prv_metrics_new(rsu_host_service_t *host_service)
+{
+	GString *str;
+	GString *labels;
+	GHashTableIter iter;
+	GHashTableIter iter2;
+	gpointer key;
+	gpointer value;
+	gpointer key2;
+	gpointer value2;
+	gchar *url;
+
+	str = g_string_new("");
+	labels = g_string_new("");
+
+	g_hash_table_iter_init(&iter, host_service->servers);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_hash_table_iter_init(&iter2,
+				       ((rsu_host_server_t *) value)->files);
+
+		while (g_hash_table_iter_next(&iter2, &key2, &value2)) {
+			url = prv_host_file_url(value, key, value2);
+			g_string_truncate(labels, 0);
+			prv_append_label(labels, "url", url);
+			prv_append_stats(str, "file", labels,
+					 &((rsu_host_file_t *) value2)->stats);
+			g_free(url);
+		}
+	}
+
+	g_hash_table_iter_init(&iter, host_service->renderers);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_string_truncate(labels, 0);
+		prv_append_label(labels, "address", key);
+		prv_append_stats(str, "renderer", labels, value);
+	}
+
+	g_string_free(labels, TRUE);
+
+	return g_string_free(str, FALSE);
+}
+
+static void prv_soup_metrics_cb(SoupServer *server, SoupMessage *msg,
+				const char *path, GHashTable *query,
+				SoupClientContext *client, gpointer user_data)
+{
+	rsu_host_server_t *hs = user_data;
+	gchar *metrics;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		goto on_error;
+	}
+
+	metrics = prv_metrics_new(hs->service);
+
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+	soup_message_set_response(msg, "text/plain; version=0.0.4",
+				  SOUP_MEMORY_TAKE, metrics, strlen(metrics));
+
+on_error:
+
+	return;
+}
+
+static rsu_host_server_t *prv_host_server_new(rsu_host_service_t *host_service,
+					      const gchar *device_if,
 					      GError **error)
 {
 	rsu_host_server_t *server = NULL;
@@ -240,6 +919,7 @@ static rsu_host_server_t *prv_host_server_new(const gchar *device_if,
 	}
 
 	server = g_new(rsu_host_server_t, 1);
+	server->service = host_service;
 	server->files = g_hash_table_new_full(g_str_hash, g_str_equal,
 					      g_free, prv_host_file_delete);
 
@@ -247,6 +927,8 @@ static rsu_host_server_t *prv_host_server_new(const gchar *device_if,
 					      NULL);
 	soup_server_add_handler(server->soup_server, HOST_SERVICE_ROOT,
 				prv_soup_server_cb, server, NULL);
+	soup_server_add_handler(server->soup_server, HOST_SERVICE_METRICS,
+				prv_soup_metrics_cb, server, NULL);
 	soup_server_run_async(server->soup_server);
 	server->counter = 0;
 
@@ -257,20 +939,438 @@ on_error:
 	return server;
 }
 
-void rsu_host_service_new(rsu_host_service_t **host_service)
+static void prv_scale_job_delete(rsu_host_scale_job_t *job)
+{
+	g_free(job->device_if);
+	g_free(job->file);
+	g_free(job->key);
+	g_free(job->cache_path);
+	g_free(job);
+}
+
+static rsu_host_scale_job_t *prv_scale_job_new(rsu_host_service_t *host_service,
+					       const gchar *device_if,
+					       const gchar *file,
+					       const gchar *key,
+					       guint width, guint height,
+					       GStatBuf *st)
+{
+	rsu_host_scale_job_t *job;
+	gchar *dir;
+	gchar *id;
+	gchar *checksum;
+	gchar *name;
+
+	/* The name of the cached image depends on the modification time
+	   and size of the original so that stale copies are never
+	   served. */
+
+	dir = g_build_filename(g_get_user_cache_dir(), PACKAGE,
+			       HOST_SERVICE_SCALE_CACHE, NULL);
+	(void) g_mkdir_with_parents(dir, 0700);
+
+	id = g_strdup_printf("%s:%"G_GINT64_FORMAT":%"G_GINT64_FORMAT, file,
+			     (gint64) st->st_mtime, (gint64) st->st_size);
+	checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, id, -1);
+	name = g_strdup_printf("%s-%s.jpg", checksum, key);
+
+	job = g_new0(rsu_host_scale_job_t, 1);
+	job->service = host_service;
+	job->device_if = g_strdup(device_if);
+	job->file = g_strdup(file);
+	job->key = g_strdup(key);
+	job->width = width;
+	job->height = height;
+	job->cache_path = g_build_filename(dir, name, NULL);
+
+	g_free(name);
+	g_free(checksum);
+	g_free(id);
+	g_free(dir);
+
+	return job;
+}
+
+static GdkPixbuf *prv_scale_pixbuf(const gchar *file, guint width,
+				   guint height)
+{
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *oriented = NULL;
+	GdkPixbuf *retval = NULL;
+	gint w;
+	gint h;
+	gdouble scale;
+
+	pixbuf = gdk_pixbuf_new_from_file_at_scale(file, width, height, TRUE,
+						   NULL);
+	if (!pixbuf)
+		goto on_error;
+
+	/* The EXIF orientation tag is lost when the image is re-encoded
+	   so the rotation needs to be applied to the pixels. */
+
+	oriented = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+	w = gdk_pixbuf_get_width(oriented);
+	h = gdk_pixbuf_get_height(oriented);
+
+	if ((guint) w > width || (guint) h > height) {
+		scale = MIN((gdouble) width / w, (gdouble) height / h);
+		retval = gdk_pixbuf_scale_simple(oriented, MAX(1, w * scale),
+						 MAX(1, h * scale),
+						 GDK_INTERP_BILINEAR);
+	} else {
+		retval = g_object_ref(oriented);
+	}
+
+on_error:
+
+	if (oriented)
+		g_object_unref(oriented);
+
+	if (pixbuf)
+		g_object_unref(pixbuf);
+
+	return retval;
+}
+
+static rsu_host_variant_t *prv_find_variant(rsu_host_service_t *host_service,
+					    const gchar *device_if,
+					    const gchar *file,
+					    const gchar *key,
+					    rsu_host_file_t **hf)
+{
+	rsu_host_server_t *server;
+	rsu_host_variant_t *retval = NULL;
+
+	server = g_hash_table_lookup(host_service->servers, device_if);
+	if (!server)
+		goto on_error;
+
+	*hf = g_hash_table_lookup(server->files, file);
+	if (!*hf)
+		goto on_error;
+
+	retval = g_hash_table_lookup((*hf)->variants, key);
+
+on_error:
+
+	return retval;
+}
+
+static gboolean prv_scale_job_complete(gpointer user_data)
+{
+	rsu_host_scale_job_t *job = user_data;
+	rsu_host_file_t *hf;
+	rsu_host_variant_t *variant;
+
+	/* The service has been deleted */
+
+	if (!job->service)
+		goto on_error;
+
+	(void) g_ptr_array_remove_fast(job->service->scale_jobs, job);
+
+	if (!job->scaled)
+		goto on_error;
+
+	variant = prv_find_variant(job->service, job->device_if, job->file,
+				   job->key, &hf);
+	if (variant && !variant->path)
+		variant->path = g_strdup(job->cache_path);
+
+on_error:
+
+	prv_scale_job_delete(job);
+
+	return FALSE;
+}
+
+static gint prv_cache_entry_compare(gconstpointer a, gconstpointer b)
+{
+	const rsu_host_cache_entry_t *e1 = *(rsu_host_cache_entry_t **) a;
+	const rsu_host_cache_entry_t *e2 = *(rsu_host_cache_entry_t **) b;
+
+	return (e1->mtime > e2->mtime) - (e1->mtime < e2->mtime);
+}
+
+static void prv_cache_entry_delete(gpointer data)
+{
+	rsu_host_cache_entry_t *entry = data;
+
+	g_free(entry->path);
+	g_free(entry);
+}
+
+/* Executed in a worker thread.  Scaled images that have not been
+   served for HOST_SERVICE_SCALE_CACHE_AGE seconds are removed, as are
+   the least recently served ones while the cache is larger than
+   HOST_SERVICE_SCALE_CACHE_SIZE.  There is a single worker so the
+   cache is never pruned while an image is being written to it. */
+
+static void prv_prune_scale_cache(const gchar *dir_path)
+{
+	GDir *dir;
+	const gchar *name;
+	GPtrArray *entries;
+	rsu_host_cache_entry_t *entry;
+	GStatBuf st;
+	gchar *path;
+	gint64 now;
+	gint64 total = 0;
+	guint i;
+
+	dir = g_dir_open(dir_path, 0, NULL);
+	if (!dir)
+		goto on_error;
+
+	entries = g_ptr_array_new_with_free_func(prv_cache_entry_delete);
+	now = g_get_real_time() / G_USEC_PER_SEC;
+
+	while ((name = g_dir_read_name(dir))) {
+		path = g_build_filename(dir_path, name, NULL);
+
+		if (g_stat(path, &st) || !S_ISREG(st.st_mode)) {
+			g_free(path);
+		} else if (now - st.st_mtime > HOST_SERVICE_SCALE_CACHE_AGE) {
+			(void) g_unlink(path);
+			g_free(path);
+		} else {
+			entry = g_new(rsu_host_cache_entry_t, 1);
+			entry->path = path;
+			entry->mtime = st.st_mtime;
+			entry->size = st.st_size;
+			total += entry->size;
+			g_ptr_array_add(entries, entry);
+		}
+	}
+
+	g_ptr_array_sort(entries, prv_cache_entry_compare);
+
+	for (i = 0; i < entries->len &&
+		     total > HOST_SERVICE_SCALE_CACHE_SIZE; ++i) {
+		entry = g_ptr_array_index(entries, i);
+		if (!g_unlink(entry->path))
+			total -= entry->size;
+	}
+
+	g_ptr_array_unref(entries);
+	g_dir_close(dir);
+
+on_error:
+
+	return;
+}
+
+/* Executed in a worker thread */
+
+static void prv_scale_image(gpointer data, gpointer user_data)
+{
+	rsu_host_scale_job_t *job = data;
+	GdkPixbuf *pixbuf = NULL;
+	gchar *tmp_path = NULL;
+	gchar *dir;
+	gint width;
+	gint height;
+
+	/* The modification time of a cached image is updated each time it
+	   is used, so that the cache is pruned in least recently used
+	   order. */
+
+	if (g_file_test(job->cache_path, G_FILE_TEST_EXISTS)) {
+		(void) g_utime(job->cache_path, NULL);
+		job->scaled = TRUE;
+		goto on_error;
+	}
+
+	if (!gdk_pixbuf_get_file_info(job->file, &width, &height))
+		goto on_error;
+
+	if ((guint) width <= job->width && (guint) height <= job->height)
+		goto on_error;
+
+	pixbuf = prv_scale_pixbuf(job->file, job->width, job->height);
+	if (!pixbuf)
+		goto on_error;
+
+	tmp_path = g_strdup_printf("%s.%p", job->cache_path, job);
+
+	if (gdk_pixbuf_save(pixbuf, tmp_path, "jpeg", NULL, "quality",
+			    HOST_SERVICE_SCALE_QUALITY, NULL) &&
+	    !g_rename(tmp_path, job->cache_path)) {
+		job->scaled = TRUE;
+		dir = g_path_get_dirname(job->cache_path);
+		prv_prune_scale_cache(dir);
+		g_free(dir);
+	} else {
+		(void) g_unlink(tmp_path);
+	}
+
+on_error:
+
+	g_free(tmp_path);
+
+	if (pixbuf)
+		g_object_unref(pixbuf);
+
+	job->done = TRUE;
+	(void) g_idle_add(prv_scale_job_complete, job);
+}
+
+void rsu_host_service_new(const rsu_settings_t *settings,
+			  rsu_host_service_t **host_service)
 {
 	rsu_host_service_t *hs;
 
 	hs = g_new(rsu_host_service_t, 1);
 	hs->servers = g_hash_table_new_full(g_str_hash, g_str_equal,
 					    g_free, prv_host_server_delete);
+	hs->renderers = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, g_free);
+	hs->scale_images = settings->scale_images;
+	hs->fan_out = settings->fan_out;
+	hs->scale_pool = g_thread_pool_new(prv_scale_image, NULL,
+					   HOST_SERVICE_SCALE_THREADS, FALSE,
+					   NULL);
+	hs->scale_jobs = g_ptr_array_new();
+	hs->lookups = g_ptr_array_new();
+	hs->cancellable = g_cancellable_new();
 
 	*host_service = hs;
 }
 
+static void prv_lookup_delete(rsu_host_lookup_t *lookup)
+{
+	g_free(lookup->device_if);
+	g_free(lookup->file);
+	g_free(lookup->key);
+	g_free(lookup);
+}
+
+static void prv_lookup_cb(GObject *source, GAsyncResult *res,
+			  gpointer user_data)
+{
+	rsu_host_lookup_t *lookup = user_data;
+	rsu_host_file_t *hf;
+	rsu_host_variant_t *variant;
+	GList *addresses;
+	GList *next;
+
+	addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), res,
+						     NULL);
+
+	/* The service has been deleted */
+
+	if (!lookup->service)
+		goto on_error;
+
+	(void) g_ptr_array_remove_fast(lookup->service->lookups, lookup);
+
+	variant = prv_find_variant(lookup->service, lookup->device_if,
+				   lookup->file, lookup->key, &hf);
+	if (!variant)
+		goto on_error;
+
+	for (next = addresses; next; next = next->next)
+		g_hash_table_replace(hf->renderer_variants,
+				     g_inet_address_to_string(next->data),
+				     variant);
+
+on_error:
+
+	g_resolver_free_addresses(addresses);
+	prv_lookup_delete(lookup);
+}
+
+/* Variants are looked up by the address of the HTTP peer, but the
+   renderer is known by the host in its description URL, which may be
+   a host name.  Host names are resolved and the variant registered
+   under each of the resulting addresses.  The original image is served
+   until the lookup completes. */
+
+static void prv_add_renderer_variant(rsu_host_service_t *host_service,
+				     rsu_host_file_t *hf,
+				     const gchar *device_if,
+				     const gchar *file, const gchar *key,
+				     const gchar *renderer)
+{
+	rsu_host_lookup_t *lookup;
+	GInetAddress *address;
+	GResolver *resolver;
+
+	address = g_inet_address_new_from_string(renderer);
+
+	if (address) {
+		g_hash_table_replace(hf->renderer_variants,
+				     g_inet_address_to_string(address),
+				     g_hash_table_lookup(hf->variants, key));
+		g_object_unref(address);
+		goto finished;
+	}
+
+	lookup = g_new(rsu_host_lookup_t, 1);
+	lookup->service = host_service;
+	lookup->device_if = g_strdup(device_if);
+	lookup->file = g_strdup(file);
+	lookup->key = g_strdup(key);
+	g_ptr_array_add(host_service->lookups, lookup);
+
+	resolver = g_resolver_get_default();
+	g_resolver_lookup_by_name_async(resolver, renderer,
+					host_service->cancellable,
+					prv_lookup_cb, lookup);
+	g_object_unref(resolver);
+
+finished:
+
+	return;
+}
+
+static void prv_add_variant(rsu_host_service_t *host_service,
+			    rsu_host_file_t *hf, const gchar *device_if,
+			    const gchar *file, const gchar *renderer,
+			    guint max_width, guint max_height)
+{
+	rsu_host_variant_t *variant;
+	rsu_host_scale_job_t *job;
+	gchar *key = NULL;
+	GStatBuf st;
+
+	if (!host_service->scale_images || !host_service->scale_pool ||
+	    !renderer || !max_width || !max_height ||
+	    strcmp(hf->mime_type, HOST_SERVICE_SCALE_MIME))
+		goto on_error;
+
+	key = g_strdup_printf("%ux%u", max_width, max_height);
+	variant = g_hash_table_lookup(hf->variants, key);
+
+	if (!variant) {
+		if (g_stat(file, &st))
+			goto on_error;
+
+		job = prv_scale_job_new(host_service, device_if, file, key,
+					max_width, max_height, &st);
+
+		variant = g_new0(rsu_host_variant_t, 1);
+		variant->width = max_width;
+		variant->height = max_height;
+		g_hash_table_insert(hf->variants, g_strdup(key), variant);
+
+		g_ptr_array_add(host_service->scale_jobs, job);
+		g_thread_pool_push(host_service->scale_pool, job, NULL);
+	}
+
+	prv_add_renderer_variant(host_service, hf, device_if, file, key,
+				 renderer);
+
+on_error:
+
+	g_free(key);
+}
+
 static gchar *prv_add_new_file(rsu_host_server_t *server, const gchar *client,
 			       const gchar *device_if, const gchar *file,
-			       GError **error)
+			       const gchar *renderer, guint max_width,
+			       guint max_height, GError **error)
 {
 	unsigned int i;
 	rsu_host_file_t *hf;
@@ -295,9 +1395,10 @@ static gchar *prv_add_new_file(rsu_host_server_t *server, const gchar *client,
 			g_ptr_array_add(hf->clients, g_strdup(client));
 	}
 
-	str = g_strdup_printf("http://%s:%d%s", device_if,
-			      soup_server_get_port(server->soup_server),
-			      hf->path);
+	prv_add_variant(server->service, hf, device_if, file, renderer,
+			max_width, max_height);
+
+	str = prv_host_file_url(server, device_if, hf);
 
 	return str;
 
@@ -308,7 +1409,9 @@ on_error:
 
 gchar *rsu_host_service_add(rsu_host_service_t *host_service,
 			    const gchar *device_if, const gchar *client,
-			    const gchar *file, GError **error)
+			    const gchar *file, const gchar *renderer,
+			    guint max_width, guint max_height,
+			    GError **error)
 {
 	rsu_host_server_t *server;
 	gchar *retval = NULL;
@@ -316,7 +1419,7 @@ gchar *rsu_host_service_add(rsu_host_service_t *host_service,
 	server = g_hash_table_lookup(host_service->servers, device_if);
 
 	if (!server) {
-		server = prv_host_server_new(device_if, error);
+		server = prv_host_server_new(host_service, device_if, error);
 
 		if (!server)
 			goto on_error;
@@ -325,7 +1428,8 @@ gchar *rsu_host_service_add(rsu_host_service_t *host_service,
 				    server);
 	}
 
-	retval = prv_add_new_file(server, client, device_if, file, error);
+	retval = prv_add_new_file(server, client, device_if, file, renderer,
+				  max_width, max_height, error);
 
 on_error:
 
@@ -428,10 +1532,120 @@ void rsu_host_service_lost_client(rsu_host_service_t *host_service,
 	}
 }
 
+static GVariant *prv_stats_to_variant(rsu_host_stats_t *stats,
+				      const gchar *path)
+{
+	GVariantBuilder vb;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	if (path)
+		g_variant_builder_add(&vb, "{sv}", "Path",
+				      g_variant_new_string(path));
+
+	g_variant_builder_add(&vb, "{sv}", "BytesSent",
+			      g_variant_new_uint64(stats->bytes_sent));
+	g_variant_builder_add(&vb, "{sv}", "Requests",
+			      g_variant_new_uint32(stats->requests));
+	g_variant_builder_add(&vb, "{sv}", "ActiveTransfers",
+			      g_variant_new_uint32(stats->active));
+	g_variant_builder_add(&vb, "{sv}", "Latency",
+			      g_variant_new_uint64(
+				      prv_stats_mean_latency(stats)));
+	g_variant_builder_add(&vb, "{sv}", "Throughput",
+			      g_variant_new_uint64(
+				      prv_stats_throughput(stats)));
+
+	return g_variant_builder_end(&vb);
+}
+
+GVariant *rsu_host_service_get_statistics(rsu_host_service_t *host_service)
+{
+	GVariantBuilder vb;
+	GVariantBuilder files_vb;
+	GVariantBuilder renderers_vb;
+	GHashTableIter iter;
+	GHashTableIter iter2;
+	gpointer key;
+	gpointer value;
+	gpointer key2;
+	gpointer value2;
+	gchar *url;
+
+	g_variant_builder_init(&files_vb, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_hash_table_iter_init(&iter, host_service->servers);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_hash_table_iter_init(&iter2,
+				       ((rsu_host_server_t *) value)->files);
+
+		while (g_hash_table_iter_next(&iter2, &key2, &value2)) {
+			url = prv_host_file_url(value, key, value2);
+			g_variant_builder_add(
+				&files_vb, "{s@a{sv}}", url,
+				prv_stats_to_variant(
+					&((rsu_host_file_t *) value2)->stats,
+					key2));
+			g_free(url);
+		}
+	}
+
+	g_variant_builder_init(&renderers_vb, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_hash_table_iter_init(&iter, host_service->renderers);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_variant_builder_add(&renderers_vb, "{s@a{sv}}", key,
+				      prv_stats_to_variant(value, NULL));
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&vb, "{sv}", "Files",
+			      g_variant_builder_end(&files_vb));
+	g_variant_builder_add(&vb, "{sv}", "Renderers",
+			      g_variant_builder_end(&renderers_vb));
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+static void prv_orphan_lookup(gpointer data, gpointer user_data)
+{
+	rsu_host_lookup_t *lookup = data;
+
+	/* The cancelled lookup still completes, and frees itself */
+
+	lookup->service = NULL;
+}
+
+static void prv_orphan_scale_job(gpointer data, gpointer user_data)
+{
+	rsu_host_scale_job_t *job = data;
+
+	/* Jobs that have completed are waiting to be delivered in an idle
+	   callback, which will free them.  The others were never run. */
+
+	if (job->done)
+		job->service = NULL;
+	else
+		prv_scale_job_delete(job);
+}
+
 void rsu_host_service_delete(rsu_host_service_t *host_service)
 {
 	if (host_service) {
+		if (host_service->scale_pool)
+			g_thread_pool_free(host_service->scale_pool, TRUE,
+					   TRUE);
+		g_ptr_array_foreach(host_service->scale_jobs,
+				    prv_orphan_scale_job, NULL);
+		g_ptr_array_unref(host_service->scale_jobs);
+
+		g_cancellable_cancel(host_service->cancellable);
+		g_ptr_array_foreach(host_service->lookups, prv_orphan_lookup,
+				    NULL);
+		g_ptr_array_unref(host_service->lookups);
+		g_object_unref(host_service->cancellable);
+
 		g_hash_table_unref(host_service->servers);
+		g_hash_table_unref(host_service->renderers);
 		g_free(host_service);
 	}
 }
@@ -23,15 +23,21 @@
 #ifndef RSU_HOST_SERVICE_H__
 #define RSU_HOST_SERVICE_H__
 
+#include "settings.h"
+
 typedef struct rsu_host_service_t_ rsu_host_service_t;
 
-void rsu_host_service_new(rsu_host_service_t **host_service);
+void rsu_host_service_new(const rsu_settings_t *settings,
+			  rsu_host_service_t **host_service);
 gchar *rsu_host_service_add(rsu_host_service_t *host_service,
 			    const gchar *device_if, const gchar *client,
-			    const gchar *file, GError **error);
+			    const gchar *file, const gchar *renderer,
+			    guint max_width, guint max_height,
+			    GError **error);
 gboolean rsu_host_service_remove(rsu_host_service_t *host_service,
 				 const gchar *device_if, const gchar *client,
 				 const gchar *file);
+GVariant *rsu_host_service_get_statistics(rsu_host_service_t *host_service);
 void rsu_host_service_lost_client(rsu_host_service_t *host_service,
 				  const gchar *client);
 void rsu_host_service_delete(rsu_host_service_t *host_service);
@@ -0,0 +1,554 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <libsoup/soup.h>
+
+#include "liveness.h"
+
+/* GUPnP only notices that a renderer has gone away without sending a
+   byebye when the max-age of its last announcement runs out, which
+   can take up to half an hour.  Until then clients' commands to the
+   renderer hang until they time out.  We therefore track the max-age
+   and the time of the last SSDP message of each renderer on each
+   network interface.  A renderer that has not been heard from when
+   three quarters of its max-age has elapsed is probed by fetching its
+   device description.  If this fails, or if the max-age runs out,
+   the renderer is reported as expired on that interface.  The
+   deadlines are kept in a single sorted sequence so that only one
+   timer is needed, however many renderers there are. */
+
+#define RSU_LIVENESS_DEFAULT_MAX_AGE 1800
+#define RSU_LIVENESS_RENDERER_TYPE "urn:schemas-upnp-org:device:MediaRenderer:"
+
+enum rsu_liveness_state_t_ {
+	RSU_LIVENESS_UNTRACKED,
+	RSU_LIVENESS_ALIVE,
+	RSU_LIVENESS_PROBING,
+	RSU_LIVENESS_EXPIRED
+};
+typedef enum rsu_liveness_state_t_ rsu_liveness_state_t;
+
+typedef struct rsu_liveness_client_t_ rsu_liveness_client_t;
+typedef struct rsu_liveness_entry_t_ rsu_liveness_entry_t;
+
+typedef struct rsu_liveness_probe_t_ rsu_liveness_probe_t;
+struct rsu_liveness_probe_t_ {
+	rsu_liveness_entry_t *entry;
+	SoupSession *session;
+	SoupMessage *msg;
+};
+
+struct rsu_liveness_entry_t_ {
+	rsu_liveness_client_t *client;
+	gchar *udn;
+	GUPnPDeviceProxy *proxy;
+	rsu_liveness_state_t state;
+	guint max_age;
+	gint64 last_seen;
+	gint64 deadline;
+	GSequenceIter *iter;
+	rsu_liveness_probe_t *probe;
+};
+
+struct rsu_liveness_client_t_ {
+	rsu_liveness_t *liveness;
+	GUPnPContext *context;
+	gulong handler_id;
+	GHashTable *entries;
+};
+
+struct rsu_liveness_t_ {
+	guint probe_timeout;
+	rsu_liveness_expired_t expired;
+	rsu_liveness_revived_t revived;
+	void *user_data;
+	GHashTable *clients;
+	GSequence *timers;
+	guint timer_id;
+	gint64 timer_deadline;
+};
+
+static gint prv_liveness_compare(gconstpointer a, gconstpointer b,
+				 gpointer user_data)
+{
+	const rsu_liveness_entry_t *entry_a = a;
+	const rsu_liveness_entry_t *entry_b = b;
+	gint retval;
+
+	if (entry_a->deadline < entry_b->deadline)
+		retval = -1;
+	else if (entry_a->deadline > entry_b->deadline)
+		retval = 1;
+	else if (entry_a < entry_b)
+		retval = -1;
+	else
+		retval = entry_a > entry_b;
+
+	return retval;
+}
+
+static gboolean prv_liveness_timer_cb(gpointer user_data);
+
+static void prv_liveness_arm(rsu_liveness_t *liveness)
+{
+	GSequenceIter *iter;
+	rsu_liveness_entry_t *entry;
+	gint64 delay;
+
+	iter = g_sequence_get_begin_iter(liveness->timers);
+	entry = g_sequence_iter_is_end(iter) ? NULL : g_sequence_get(iter);
+
+	if (liveness->timer_id) {
+		if (entry && entry->deadline == liveness->timer_deadline)
+			goto on_error;
+
+		(void) g_source_remove(liveness->timer_id);
+		liveness->timer_id = 0;
+	}
+
+	if (!entry)
+		goto on_error;
+
+	delay = (entry->deadline - g_get_monotonic_time()) / 1000;
+	if (delay < 0)
+		delay = 0;
+
+	liveness->timer_deadline = entry->deadline;
+	liveness->timer_id = g_timeout_add(delay, prv_liveness_timer_cb,
+					   liveness);
+
+on_error:
+
+	return;
+}
+
+static void prv_liveness_unschedule(rsu_liveness_entry_t *entry)
+{
+	if (entry->iter) {
+		g_sequence_remove(entry->iter);
+		entry->iter = NULL;
+	}
+}
+
+static void prv_liveness_schedule(rsu_liveness_entry_t *entry,
+				  gint64 deadline)
+{
+	rsu_liveness_t *liveness = entry->client->liveness;
+
+	entry->deadline = deadline;
+
+	if (entry->iter)
+		g_sequence_sort_changed(entry->iter, prv_liveness_compare,
+					NULL);
+	else
+		entry->iter = g_sequence_insert_sorted(liveness->timers, entry,
+						       prv_liveness_compare,
+						       NULL);
+
+	prv_liveness_arm(liveness);
+}
+
+static void prv_liveness_schedule_alive(rsu_liveness_entry_t *entry)
+{
+	gint64 lifetime = entry->max_age * G_USEC_PER_SEC;
+
+	if (entry->client->liveness->probe_timeout)
+		lifetime = lifetime * 3 / 4;
+
+	prv_liveness_schedule(entry, entry->last_seen + lifetime);
+}
+
+static void prv_liveness_cancel_probe(rsu_liveness_entry_t *entry)
+{
+	rsu_liveness_probe_t *probe = entry->probe;
+
+	/* The probe's callback is always called, possibly from within
+	   soup_session_cancel_message, and frees the probe. */
+
+	if (probe) {
+		entry->probe = NULL;
+		probe->entry = NULL;
+		soup_session_cancel_message(probe->session, probe->msg,
+					    SOUP_STATUS_CANCELLED);
+	}
+}
+
+static void prv_liveness_expire(rsu_liveness_entry_t *entry)
+{
+	rsu_liveness_client_t *client = entry->client;
+	rsu_liveness_t *liveness = client->liveness;
+
+	prv_liveness_cancel_probe(entry);
+	prv_liveness_unschedule(entry);
+	entry->state = RSU_LIVENESS_EXPIRED;
+
+	g_debug("Renderer %s has not been heard from on %s for %"
+		G_GINT64_FORMAT " seconds, expiring it", entry->udn,
+		gupnp_context_get_host_ip(client->context),
+		(g_get_monotonic_time() - entry->last_seen) /
+		G_USEC_PER_SEC);
+
+	liveness->expired(client->context, entry->udn, liveness->user_data);
+}
+
+static void prv_liveness_seen(rsu_liveness_entry_t *entry, guint max_age)
+{
+	rsu_liveness_t *liveness = entry->client->liveness;
+	gboolean revived = entry->state == RSU_LIVENESS_EXPIRED;
+
+	entry->last_seen = g_get_monotonic_time();
+	entry->max_age = max_age;
+
+	if (entry->state == RSU_LIVENESS_UNTRACKED)
+		goto on_error;
+
+	prv_liveness_cancel_probe(entry);
+	entry->state = RSU_LIVENESS_ALIVE;
+	prv_liveness_schedule_alive(entry);
+
+	if (revived) {
+		g_debug("Renderer %s has returned on %s", entry->udn,
+			gupnp_context_get_host_ip(entry->client->context));
+
+		liveness->revived(entry->client->context, entry->proxy,
+				  entry->udn, liveness->user_data);
+	}
+
+on_error:
+
+	return;
+}
+
+static void prv_liveness_probe_cb(SoupSession *session, SoupMessage *msg,
+				  gpointer user_data)
+{
+	rsu_liveness_probe_t *probe = user_data;
+	rsu_liveness_entry_t *entry = probe->entry;
+
+	if (!entry)
+		goto on_error;
+
+	entry->probe = NULL;
+
+	/* Any HTTP response at all shows that the renderer is still
+	   there. */
+
+	if (SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code))
+		prv_liveness_expire(entry);
+	else
+		prv_liveness_seen(entry, entry->max_age);
+
+on_error:
+
+	g_free(probe);
+}
+
+static void prv_liveness_probe(rsu_liveness_entry_t *entry)
+{
+	rsu_liveness_t *liveness = entry->client->liveness;
+	rsu_liveness_probe_t *probe;
+	const char *location;
+	SoupMessage *msg = NULL;
+	gint64 deadline;
+
+	location = gupnp_device_info_get_location(
+		GUPNP_DEVICE_INFO(entry->proxy));
+	if (location)
+		msg = soup_message_new(SOUP_METHOD_GET, location);
+
+	entry->state = RSU_LIVENESS_PROBING;
+	deadline = entry->last_seen + entry->max_age * G_USEC_PER_SEC;
+
+	if (msg) {
+		probe = g_new(rsu_liveness_probe_t, 1);
+		probe->entry = entry;
+		probe->session = gupnp_context_get_session(
+			entry->client->context);
+		probe->msg = msg;
+		entry->probe = probe;
+
+		soup_session_queue_message(probe->session, msg,
+					   prv_liveness_probe_cb, probe);
+
+		deadline = MIN(deadline, g_get_monotonic_time() +
+			       liveness->probe_timeout * G_USEC_PER_SEC);
+	}
+
+	prv_liveness_schedule(entry, deadline);
+}
+
+static gboolean prv_liveness_timer_cb(gpointer user_data)
+{
+	rsu_liveness_t *liveness = user_data;
+	GSequenceIter *iter;
+	rsu_liveness_entry_t *entry;
+	gint64 now = g_get_monotonic_time();
+
+	liveness->timer_id = 0;
+
+	for (;;) {
+		iter = g_sequence_get_begin_iter(liveness->timers);
+		if (g_sequence_iter_is_end(iter))
+			break;
+
+		entry = g_sequence_get(iter);
+		if (entry->deadline > now)
+			break;
+
+		prv_liveness_unschedule(entry);
+
+		if (entry->state == RSU_LIVENESS_ALIVE &&
+		    liveness->probe_timeout && entry->proxy)
+			prv_liveness_probe(entry);
+		else
+			prv_liveness_expire(entry);
+	}
+
+	prv_liveness_arm(liveness);
+
+	return FALSE;
+}
+
+static rsu_liveness_entry_t *prv_liveness_entry_new(
+	rsu_liveness_client_t *client, const gchar *udn)
+{
+	rsu_liveness_entry_t *entry = g_new0(rsu_liveness_entry_t, 1);
+
+	entry->client = client;
+	entry->udn = g_strdup(udn);
+	entry->state = RSU_LIVENESS_UNTRACKED;
+	entry->max_age = RSU_LIVENESS_DEFAULT_MAX_AGE;
+	entry->last_seen = g_get_monotonic_time();
+
+	g_hash_table_insert(client->entries, entry->udn, entry);
+
+	return entry;
+}
+
+static void prv_liveness_entry_delete(gpointer data)
+{
+	rsu_liveness_entry_t *entry = data;
+
+	prv_liveness_cancel_probe(entry);
+	prv_liveness_unschedule(entry);
+
+	if (entry->proxy)
+		g_object_unref(entry->proxy);
+	g_free(entry->udn);
+	g_free(entry);
+}
+
+static guint prv_liveness_max_age(SoupMessageHeaders *headers)
+{
+	const char *cache_control;
+	const char *max_age;
+	char *end;
+	gulong value;
+	guint retval = RSU_LIVENESS_DEFAULT_MAX_AGE;
+
+	cache_control = soup_message_headers_get_one(headers,
+						     "Cache-Control");
+	if (!cache_control)
+		goto on_error;
+
+	max_age = strstr(cache_control, "max-age");
+	if (!max_age)
+		goto on_error;
+
+	max_age += strlen("max-age");
+	while (*max_age == ' ' || *max_age == '\t')
+		++max_age;
+
+	if (*max_age++ != '=')
+		goto on_error;
+
+	value = strtoul(max_age, &end, 10);
+	if (end != max_age && value > 0 && value <= G_MAXUINT)
+		retval = value;
+
+on_error:
+
+	return retval;
+}
+
+static void prv_message_received_cb(GSSDPClient *gssdp_client,
+				    const gchar *from_ip,
+				    guint from_port,
+				    gint type,
+				    SoupMessageHeaders *headers,
+				    gpointer user_data)
+{
+	rsu_liveness_client_t *client = user_data;
+	rsu_liveness_entry_t *entry;
+	const char *usn;
+	const char *nts;
+	const char *target;
+	const char *sep;
+	gchar *udn;
+
+	/* Only announcements and search responses carry a USN. */
+
+	usn = soup_message_headers_get_one(headers, "USN");
+	if (!usn)
+		goto on_error;
+
+	nts = soup_message_headers_get_one(headers, "NTS");
+	if (nts && !strcmp(nts, "ssdp:byebye"))
+		goto on_error;
+
+	sep = strstr(usn, "::");
+	udn = sep ? g_strndup(usn, sep - usn) : g_strdup(usn);
+
+	entry = g_hash_table_lookup(client->entries, udn);
+
+	if (!entry) {
+		target = soup_message_headers_get_one(headers, "NT");
+		if (!target)
+			target = soup_message_headers_get_one(headers, "ST");
+
+		if (target && g_str_has_prefix(target,
+					       RSU_LIVENESS_RENDERER_TYPE))
+			entry = prv_liveness_entry_new(client, udn);
+	}
+
+	if (entry)
+		prv_liveness_seen(entry, prv_liveness_max_age(headers));
+
+	g_free(udn);
+
+on_error:
+
+	return;
+}
+
+static void prv_liveness_client_delete(gpointer data)
+{
+	rsu_liveness_client_t *client = data;
+
+	g_signal_handler_disconnect(client->context, client->handler_id);
+	g_hash_table_unref(client->entries);
+	g_object_unref(client->context);
+	g_free(client);
+}
+
+void rsu_liveness_new(const rsu_settings_t *settings,
+		      rsu_liveness_expired_t expired,
+		      rsu_liveness_revived_t revived,
+		      void *user_data, rsu_liveness_t **liveness)
+{
+	rsu_liveness_t *l = g_new0(rsu_liveness_t, 1);
+
+	l->probe_timeout = settings->probe_timeout;
+	l->expired = expired;
+	l->revived = revived;
+	l->user_data = user_data;
+	l->clients = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					   NULL, prv_liveness_client_delete);
+	l->timers = g_sequence_new(NULL);
+
+	*liveness = l;
+}
+
+void rsu_liveness_delete(rsu_liveness_t *liveness)
+{
+	if (liveness) {
+		g_hash_table_unref(liveness->clients);
+
+		if (liveness->timer_id)
+			(void) g_source_remove(liveness->timer_id);
+
+		g_sequence_free(liveness->timers);
+		g_free(liveness);
+	}
+}
+
+void rsu_liveness_watch(rsu_liveness_t *liveness, GUPnPContext *context)
+{
+	rsu_liveness_client_t *client = g_new0(rsu_liveness_client_t, 1);
+
+	client->liveness = liveness;
+	client->context = g_object_ref(context);
+	client->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL,
+						prv_liveness_entry_delete);
+	client->handler_id = g_signal_connect(
+		context, "message-received",
+		G_CALLBACK(prv_message_received_cb), client);
+
+	g_hash_table_insert(liveness->clients, context, client);
+}
+
+void rsu_liveness_context_unavailable(rsu_liveness_t *liveness,
+				      GUPnPContext *context)
+{
+	(void) g_hash_table_remove(liveness->clients, context);
+	prv_liveness_arm(liveness);
+}
+
+void rsu_liveness_add(rsu_liveness_t *liveness, GUPnPContext *context,
+		      GUPnPDeviceProxy *proxy, const gchar *udn)
+{
+	rsu_liveness_client_t *client;
+	rsu_liveness_entry_t *entry;
+
+	client = g_hash_table_lookup(liveness->clients, context);
+	if (!client)
+		goto on_error;
+
+	entry = g_hash_table_lookup(client->entries, udn);
+	if (!entry)
+		entry = prv_liveness_entry_new(client, udn);
+
+	if (entry->proxy != proxy) {
+		if (entry->proxy)
+			g_object_unref(entry->proxy);
+		entry->proxy = g_object_ref(proxy);
+	}
+
+	if (entry->state != RSU_LIVENESS_UNTRACKED)
+		goto on_error;
+
+	entry->state = RSU_LIVENESS_ALIVE;
+	prv_liveness_schedule_alive(entry);
+
+on_error:
+
+	return;
+}
+
+void rsu_liveness_remove(rsu_liveness_t *liveness, GUPnPContext *context,
+			 const gchar *udn)
+{
+	rsu_liveness_client_t *client;
+
+	client = g_hash_table_lookup(liveness->clients, context);
+	if (client) {
+		(void) g_hash_table_remove(client->entries, udn);
+		prv_liveness_arm(liveness);
+	}
+}
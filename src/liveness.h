@@ -0,0 +1,52 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+#ifndef RSU_LIVENESS_H__
+#define RSU_LIVENESS_H__
+
+#include <libgupnp/gupnp-control-point.h>
+
+#include "settings.h"
+
+typedef struct rsu_liveness_t_ rsu_liveness_t;
+
+typedef void (*rsu_liveness_expired_t)(GUPnPContext *context,
+				       const gchar *udn, void *user_data);
+typedef void (*rsu_liveness_revived_t)(GUPnPContext *context,
+				       GUPnPDeviceProxy *proxy,
+				       const gchar *udn, void *user_data);
+
+void rsu_liveness_new(const rsu_settings_t *settings,
+		      rsu_liveness_expired_t expired,
+		      rsu_liveness_revived_t revived,
+		      void *user_data, rsu_liveness_t **liveness);
+void rsu_liveness_delete(rsu_liveness_t *liveness);
+void rsu_liveness_watch(rsu_liveness_t *liveness, GUPnPContext *context);
+void rsu_liveness_context_unavailable(rsu_liveness_t *liveness,
+				      GUPnPContext *context);
+void rsu_liveness_add(rsu_liveness_t *liveness, GUPnPContext *context,
+		      GUPnPDeviceProxy *proxy, const gchar *udn);
+void rsu_liveness_remove(rsu_liveness_t *liveness, GUPnPContext *context,
+			 const gchar *udn);
+
+#endif
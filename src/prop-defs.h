@@ -24,6 +24,8 @@
 #define RSU_PROPS_DEFS_H__
 
 #define RSU_INTERFACE_PROPERTIES "org.freedesktop.DBus.Properties"
+#define RSU_INTERFACE_PROPERTIES_CHANGED "PropertiesChanged"
+#define RSU_INTERFACE_OBJECT_MANAGER "org.freedesktop.DBus.ObjectManager"
 #define RSU_INTERFACE_SERVER "org.mpris.MediaPlayer2"
 #define RSU_INTERFACE_PLAYER "org.mpris.MediaPlayer2.Player"
 
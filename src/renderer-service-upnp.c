@@ -32,22 +32,47 @@
 #include <stdio.h>
 
 #include "task.h"
+#include "task-queue.h"
 #include "upnp.h"
 #include "prop-defs.h"
 #include "error.h"
+#include "settings.h"
+
+#define RSU_MAX_TASKS_IN_FLIGHT 16
+#define RSU_MAX_TASKS_HELD 16
+
+#define RSU_GROUP_PLAY_SETTLE_MS 1000
+#define RSU_GROUP_PLAY_SAMPLE_MS 250
+#define RSU_GROUP_PLAY_SAMPLES 4
 
 #define RSU_INTERFACE_GET_VERSION "GetVersion"
 #define RSU_INTERFACE_GET_SERVERS "GetServers"
+#define RSU_INTERFACE_GET_SERVERS_WITH_PROPERTIES "GetServersWithProperties"
 #define RSU_INTERFACE_RELEASE "Release"
+#define RSU_INTERFACE_GET_HOST_STATISTICS "GetHostStatistics"
+#define RSU_INTERFACE_GET_FILTER "GetFilter"
+#define RSU_INTERFACE_SET_FILTER "SetFilter"
+#define RSU_INTERFACE_GROUP_COMMAND "GroupCommand"
+#define RSU_INTERFACE_GROUP_PLAY "GroupPlay"
 
 #define RSU_INTERFACE_FOUND_SERVER "FoundServer"
 #define RSU_INTERFACE_LOST_SERVER "LostServer"
 
+#define RSU_INTERFACE_GET_MANAGED_OBJECTS "GetManagedObjects"
+#define RSU_INTERFACE_INTERFACES_ADDED "InterfacesAdded"
+#define RSU_INTERFACE_INTERFACES_REMOVED "InterfacesRemoved"
+#define RSU_INTERFACE_OBJECTS "objects"
+#define RSU_INTERFACE_OBJECT_PATH "object_path"
+#define RSU_INTERFACE_INTERFACES_AND_PROPERTIES "interfaces_and_properties"
+#define RSU_INTERFACE_INTERFACES "interfaces"
+
 #define RSU_INTERFACE_HOST_FILE "HostFile"
 #define RSU_INTERFACE_REMOVE_FILE "RemoveFile"
 
 #define RSU_INTERFACE_VERSION "Version"
 #define RSU_INTERFACE_SERVERS "Servers"
+#define RSU_INTERFACE_STATISTICS "Statistics"
+#define RSU_INTERFACE_FILTER "Filter"
 
 #define RSU_INTERFACE_PATH "Path"
 #define RSU_INTERFACE_URI "Uri"
@@ -58,6 +83,8 @@
 #define RSU_INTERFACE_INTERFACE_NAME "interface_name"
 #define RSU_INTERFACE_PROPERTY_NAME "property_name"
 #define RSU_INTERFACE_PROPERTIES_VALUE "properties"
+#define RSU_INTERFACE_CHANGED_PROPERTIES "changed_properties"
+#define RSU_INTERFACE_INVALIDATED_PROPERTIES "invalidated_properties"
 #define RSU_INTERFACE_VALUE "value"
 #define RSU_INTERFACE_OFFSET "offset"
 #define RSU_INTERFACE_POSITION "position"
@@ -75,10 +102,24 @@
 #define RSU_INTERFACE_SEEK "Seek"
 #define RSU_INTERFACE_SET_POSITION "SetPosition"
 
+#define RSU_INTERFACE_BATCH "Batch"
+#define RSU_INTERFACE_COMMANDS "commands"
+#define RSU_INTERFACE_RESULTS "results"
+#define RSU_INTERFACE_COMMAND "command"
+#define RSU_INTERFACE_ARGUMENTS "arguments"
+#define RSU_INTERFACE_SKEW "skew"
+#define RSU_INTERFACE_GET_PROPERTIES "GetProperties"
+#define RSU_INTERFACE_PROPERTY_NAMES "property_names"
+#define RSU_INTERFACE_GET_CHANGES_SINCE "GetChangesSince"
+#define RSU_INTERFACE_PROPS_VERSION "version"
+#define RSU_INTERFACE_COMPLETE "complete"
+#define RSU_INTERFACE_CHANGES "changes"
+
 typedef struct rsu_context_t_ rsu_context_t;
 struct rsu_context_t_ {
 	bool error;
 	guint rsu_id;
+	guint object_manager_id;
 	guint sig_id;
 	guint idle_id;
 	guint owner_id;
@@ -87,10 +128,17 @@ struct rsu_context_t_ {
 	GMainLoop *main_loop;
 	GDBusConnection *connection;
 	gboolean quitting;
-	GPtrArray *tasks;
+	rsu_task_queue_t *tasks;
+	GHashTable *reads;
 	GHashTable *watchers;
-	GCancellable *cancellable;
+	GPtrArray *in_flight;
+	GPtrArray *measuring;
+	GPtrArray *held;
+	GHashTable *replies;
+	GHashTable *start_latencies;
+	guint watchdog_id;
 	rsu_upnp_t *upnp;
+	rsu_settings_t *settings;
 };
 
 static const gchar g_rsu_root_introspection[] =
@@ -106,6 +154,42 @@ static const gchar g_rsu_root_introspection[] =
 	"      <arg type='as' name='"RSU_INTERFACE_SERVERS"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <method name='"RSU_INTERFACE_GET_SERVERS_WITH_PROPERTIES"'>"
+	"      <arg type='a{oa{sv}}' name='"RSU_INTERFACE_SERVERS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GET_HOST_STATISTICS"'>"
+	"      <arg type='a{sv}' name='"RSU_INTERFACE_STATISTICS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GET_FILTER"'>"
+	"      <arg type='a{sv}' name='"RSU_INTERFACE_FILTER"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_SET_FILTER"'>"
+	"      <arg type='a{sv}' name='"RSU_INTERFACE_FILTER"'"
+	"           direction='in'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GROUP_COMMAND"'>"
+	"      <arg type='as' name='"RSU_INTERFACE_SERVERS"'"
+	"           direction='in'/>"
+	"      <arg type='s' name='"RSU_INTERFACE_COMMAND"'"
+	"           direction='in'/>"
+	"      <arg type='av' name='"RSU_INTERFACE_ARGUMENTS"'"
+	"           direction='in'/>"
+	"      <arg type='a{s(sav)}' name='"RSU_INTERFACE_RESULTS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GROUP_PLAY"'>"
+	"      <arg type='as' name='"RSU_INTERFACE_SERVERS"'"
+	"           direction='in'/>"
+	"      <arg type='x' name='"RSU_INTERFACE_POSITION"'"
+	"           direction='in'/>"
+	"      <arg type='a{s(sav)}' name='"RSU_INTERFACE_RESULTS"'"
+	"           direction='out'/>"
+	"      <arg type='x' name='"RSU_INTERFACE_SKEW"'"
+	"           direction='out'/>"
+	"    </method>"
 	"    <signal name='"RSU_INTERFACE_FOUND_SERVER"'>"
 	"      <arg type='s' name='"RSU_INTERFACE_PATH"'/>"
 	"    </signal>"
@@ -113,6 +197,21 @@ static const gchar g_rsu_root_introspection[] =
 	"      <arg type='s' name='"RSU_INTERFACE_PATH"'/>"
 	"    </signal>"
 	"  </interface>"
+	"  <interface name='"RSU_INTERFACE_OBJECT_MANAGER"'>"
+	"    <method name='"RSU_INTERFACE_GET_MANAGED_OBJECTS"'>"
+	"      <arg type='a{oa{sa{sv}}}' name='"RSU_INTERFACE_OBJECTS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <signal name='"RSU_INTERFACE_INTERFACES_ADDED"'>"
+	"      <arg type='o' name='"RSU_INTERFACE_OBJECT_PATH"'/>"
+	"      <arg type='a{sa{sv}}'"
+	"           name='"RSU_INTERFACE_INTERFACES_AND_PROPERTIES"'/>"
+	"    </signal>"
+	"    <signal name='"RSU_INTERFACE_INTERFACES_REMOVED"'>"
+	"      <arg type='o' name='"RSU_INTERFACE_OBJECT_PATH"'/>"
+	"      <arg type='as' name='"RSU_INTERFACE_INTERFACES"'/>"
+	"    </signal>"
+	"  </interface>"
 	"</node>";
 
 static const gchar g_rsu_server_introspection[] =
@@ -132,6 +231,11 @@ static const gchar g_rsu_server_introspection[] =
 	"      <arg type='a{sv}' name='"RSU_INTERFACE_PROPERTIES_VALUE"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <signal name='"RSU_INTERFACE_PROPERTIES_CHANGED"'>"
+	"      <arg type='s' name='"RSU_INTERFACE_INTERFACE_NAME"'/>"
+	"      <arg type='a{sv}' name='"RSU_INTERFACE_CHANGED_PROPERTIES"'/>"
+	"      <arg type='as' name='"RSU_INTERFACE_INVALIDATED_PROPERTIES"'/>"
+	"    </signal>"
 	"  </interface>"
 	"  <interface name='"RSU_INTERFACE_SERVER"'>"
 	"    <method name='"RSU_INTERFACE_RAISE"'>"
@@ -221,6 +325,30 @@ static const gchar g_rsu_server_introspection[] =
 	"           direction='in'/>"
 	"    </method>"
 	"  </interface>"
+	"  <interface name='"RSU_INTERFACE_RENDERER_DEVICE"'>"
+	"    <method name='"RSU_INTERFACE_BATCH"'>"
+	"      <arg type='a(sav)' name='"RSU_INTERFACE_COMMANDS"'"
+	"           direction='in'/>"
+	"      <arg type='a(sav)' name='"RSU_INTERFACE_RESULTS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GET_PROPERTIES"'>"
+	"      <arg type='as' name='"RSU_INTERFACE_PROPERTY_NAMES"'"
+	"           direction='in'/>"
+	"      <arg type='a{sv}' name='"RSU_INTERFACE_PROPERTIES_VALUE"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"RSU_INTERFACE_GET_CHANGES_SINCE"'>"
+	"      <arg type='t' name='"RSU_INTERFACE_PROPS_VERSION"'"
+	"           direction='in'/>"
+	"      <arg type='t' name='"RSU_INTERFACE_PROPS_VERSION"'"
+	"           direction='out'/>"
+	"      <arg type='b' name='"RSU_INTERFACE_COMPLETE"'"
+	"           direction='out'/>"
+	"      <arg type='a{sa{sv}}' name='"RSU_INTERFACE_CHANGES"'"
+	"           direction='out'/>"
+	"    </method>"
+	"  </interface>"
 	"</node>";
 
 
@@ -235,6 +363,15 @@ static void prv_rsu_method_call(GDBusConnection *conn,
 				GDBusMethodInvocation *invocation,
 				gpointer user_data);
 
+static void prv_object_manager_method_call(GDBusConnection *conn,
+					   const gchar *sender,
+					   const gchar *object,
+					   const gchar *interface,
+					   const gchar *method,
+					   GVariant *parameters,
+					   GDBusMethodInvocation *invocation,
+					   gpointer user_data);
+
 static void prv_rsu_device_method_call(GDBusConnection *conn,
 				       const gchar *sender,
 				       const gchar *object,
@@ -271,12 +408,28 @@ static void prv_rsu_push_host_method_call(GDBusConnection *conn,
 					  GDBusMethodInvocation *invocation,
 					  gpointer user_data);
 
+static void prv_rsu_renderer_device_method_call(
+	GDBusConnection *conn,
+	const gchar *sender,
+	const gchar *object,
+	const gchar *interface,
+	const gchar *method,
+	GVariant *parameters,
+	GDBusMethodInvocation *invocation,
+	gpointer user_data);
+
 static const GDBusInterfaceVTable g_rsu_vtable = {
 	prv_rsu_method_call,
 	NULL,
 	NULL
 };
 
+static const GDBusInterfaceVTable g_object_manager_vtable = {
+	prv_object_manager_method_call,
+	NULL,
+	NULL
+};
+
 static const GDBusInterfaceVTable g_props_vtable = {
 	prv_props_method_call,
 	NULL,
@@ -301,159 +454,949 @@ static const GDBusInterfaceVTable g_rsu_push_host_vtable = {
 	NULL
 };
 
+static const GDBusInterfaceVTable g_rsu_renderer_device_vtable = {
+	prv_rsu_renderer_device_method_call,
+	NULL,
+	NULL
+};
+
 static const GDBusInterfaceVTable *g_server_vtables[RSU_INTERFACE_INFO_MAX] = {
 	&g_props_vtable,
 	&g_rsu_device_vtable,
 	&g_rsu_player_vtable,
-	&g_rsu_push_host_vtable
+	&g_rsu_push_host_vtable,
+	&g_rsu_renderer_device_vtable
 };
 
-static void prv_free_rsu_task_cb(gpointer data, gpointer user_data)
-{
-	rsu_task_delete(data);
+static void prv_process_sync_task(rsu_context_t *context, rsu_task_t *task)
+{
+	GError *error;
+
+	switch (task->type) {
+	case RSU_TASK_GET_VERSION:
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_GET_SERVERS:
+		task->result = rsu_upnp_get_server_ids(context->upnp);
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_GET_SERVERS_WITH_PROPS:
+		task->result = rsu_upnp_get_servers_with_props(context->upnp);
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_GET_MANAGED_OBJECTS:
+		task->result = rsu_upnp_get_managed_objects(context->upnp);
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_GET_HOST_STATISTICS:
+		task->result = rsu_upnp_get_host_statistics(context->upnp);
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_GET_FILTER:
+		task->result = rsu_upnp_get_filter(context->upnp);
+		rsu_task_complete_and_delete(task);
+		break;
+	case RSU_TASK_SET_FILTER:
+		error = NULL;
+		if (rsu_upnp_set_filter(context->upnp, task->set_filter.filter,
+					&error)) {
+			rsu_task_complete_and_delete(task);
+		} else {
+			rsu_task_fail_and_delete(task, error);
+			g_error_free(error);
+		}
+		break;
+	case RSU_TASK_RAISE:
+	case RSU_TASK_QUIT:
+		error = g_error_new(RSU_ERROR, RSU_ERROR_NOT_SUPPORTED,
+				    "Command not supported.");
+		rsu_task_fail_and_delete(task, error);
+		g_error_free(error);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The device layer times out individual UPnP actions, but a task can
+   also be held up elsewhere, for example by a renderer that is slow to
+   deliver events.  The watchdog reports, once per period, any task
+   that has been running for longer than the watchdog period. */
+
+static gboolean prv_watchdog_cb(gpointer user_data)
+{
+	rsu_context_t *context = user_data;
+	rsu_task_t *task;
+	gint64 elapsed;
+	unsigned int i;
+
+	for (i = 0; i < context->in_flight->len; ++i) {
+		task = g_ptr_array_index(context->in_flight, i);
+		elapsed = (g_get_monotonic_time() - task->start_time) /
+			G_USEC_PER_SEC;
+
+		if (elapsed >= context->settings->watchdog)
+			g_warning("%s on %s has been running for %"
+				  G_GINT64_FORMAT " seconds",
+				  g_dbus_method_invocation_get_method_name(
+					  task->invocation),
+				  g_dbus_method_invocation_get_object_path(
+					  task->invocation),
+				  elapsed);
+	}
+
+	return TRUE;
+}
+
+static guint prv_max_in_flight(rsu_context_t *context)
+{
+	return context->settings->pipelining ? RSU_MAX_TASKS_IN_FLIGHT : 1;
+}
+
+static void prv_schedule_tasks(rsu_context_t *context)
+{
+	if (!context->idle_id && !context->quitting &&
+	    context->in_flight->len < prv_max_in_flight(context) &&
+	    (context->held->len || !rsu_task_queue_is_empty(context->tasks)))
+		context->idle_id = g_idle_add(prv_process_task, context);
+}
+
+/* When tasks are pipelined, a task can complete before a task from
+   the same client that was started before it.  Each client's replies
+   are therefore held back until the replies to all of the client's
+   earlier tasks have been sent. */
+
+static void prv_reply_order_free(gpointer order)
+{
+	g_queue_free(order);
+}
+
+static void prv_reply_order_add(rsu_context_t *context, rsu_task_t *task)
+{
+	const gchar *sender;
+	GQueue *order;
+
+	sender = g_dbus_method_invocation_get_sender(task->invocation);
+	order = g_hash_table_lookup(context->replies, sender);
+
+	if (!order) {
+		order = g_queue_new();
+		g_hash_table_insert(context->replies, g_strdup(sender), order);
+	}
+
+	g_queue_push_tail(order, task);
+}
+
+static void prv_reply_order_flush(rsu_context_t *context, rsu_task_t *task)
+{
+	const gchar *sender;
+	GQueue *order;
+	rsu_task_t *head;
+
+	sender = g_dbus_method_invocation_get_sender(task->invocation);
+	order = g_hash_table_lookup(context->replies, sender);
+
+	while ((head = g_queue_peek_head(order)) && head->done) {
+		(void) g_queue_pop_head(order);
+
+		if (head->error)
+			rsu_task_fail_and_delete(head, head->error);
+		else
+			rsu_task_complete_and_delete(head);
+	}
+
+	if (g_queue_is_empty(order))
+		(void) g_hash_table_remove(context->replies, sender);
+}
+
+/* A follower is completed with its leader, from the leader's sender's
+   reply queue.  With pipelining enabled, replies must reach each sender
+   in order, so reads are only shared between tasks from one sender. */
+
+static gchar *prv_read_task_key(rsu_context_t *context, rsu_task_t *task)
+{
+	gchar *key;
+	gchar *retval;
+
+	key = rsu_task_read_key(task);
+
+	if (!key || !context->settings->pipelining) {
+		retval = key;
+		goto on_error;
+	}
+
+	retval = g_strdup_printf("%s\n%s", key,
+				 g_dbus_method_invocation_get_sender(
+					 task->invocation));
+	g_free(key);
+
+on_error:
+
+	return retval;
+}
+
+static void prv_release_task(rsu_context_t *context, rsu_task_t *task)
+{
+	(void) g_ptr_array_remove_fast(context->in_flight, task);
+
+	if (!context->in_flight->len && context->watchdog_id) {
+		(void) g_source_remove(context->watchdog_id);
+		context->watchdog_id = 0;
+	}
+}
+
+static void prv_async_task_complete(rsu_task_t *task, GVariant *result,
+				    GError *error, void *user_data)
+{
+	rsu_context_t *context = user_data;
+	gchar *key;
+
+	prv_release_task(context, task);
+	(void) g_ptr_array_remove_fast(context->measuring, task);
+
+	key = prv_read_task_key(context, task);
+	if (key) {
+		if (g_hash_table_lookup(context->reads, key) == task)
+			(void) g_hash_table_remove(context->reads, key);
+		g_free(key);
+	}
+
+	task->done = TRUE;
+	task->result = result;
+	task->error = error;
+	prv_reply_order_flush(context, task);
+
+	if (context->quitting) {
+		if (!context->in_flight->len && !context->measuring->len)
+			g_main_loop_quit(context->main_loop);
+	} else {
+		prv_schedule_tasks(context);
+	}
+}
+
+static void prv_dispatch_task(rsu_context_t *context, rsu_task_t *task,
+			      GCancellable *cancellable,
+			      rsu_upnp_task_complete_t cb, void *user_data)
+{
+	switch (task->type) {
+	case RSU_TASK_GET_PROP:
+		rsu_upnp_get_prop(context->upnp, task, cancellable,
+				  cb, user_data);
+		break;
+	case RSU_TASK_GET_ALL_PROPS:
+		rsu_upnp_get_all_props(context->upnp, task, cancellable,
+				       cb, user_data);
+		break;
+	case RSU_TASK_GET_SELECTED_PROPS:
+		rsu_upnp_get_selected_props(context->upnp, task, cancellable,
+					    cb, user_data);
+		break;
+	case RSU_TASK_GET_CHANGES:
+		rsu_upnp_get_changes(context->upnp, task, cancellable, cb,
+				     user_data);
+		break;
+	case RSU_TASK_PLAY:
+		rsu_upnp_play(context->upnp, task, cancellable, cb, user_data);
+		break;
+	case RSU_TASK_PAUSE:
+		rsu_upnp_pause(context->upnp, task, cancellable, cb, user_data);
+		break;
+	case RSU_TASK_PLAY_PAUSE:
+		rsu_upnp_play_pause(context->upnp, task, cancellable,
+				    cb, user_data);
+		break;
+	case RSU_TASK_STOP:
+		rsu_upnp_stop(context->upnp, task, cancellable, cb, user_data);
+		break;
+	case RSU_TASK_NEXT:
+		rsu_upnp_next(context->upnp, task, cancellable, cb, user_data);
+		break;
+	case RSU_TASK_PREVIOUS:
+		rsu_upnp_previous(context->upnp, task, cancellable,
+				  cb, user_data);
+		break;
+	case RSU_TASK_OPEN_URI:
+		rsu_upnp_open_uri(context->upnp, task, cancellable,
+				  cb, user_data);
+		break;
+	case RSU_TASK_SEEK:
+		rsu_upnp_seek(context->upnp, task, cancellable, cb, user_data);
+		break;
+	case RSU_TASK_SET_POSITION:
+		rsu_upnp_set_position(context->upnp, task, cancellable,
+				      cb, user_data);
+		break;
+	case RSU_TASK_HOST_URI:
+		rsu_upnp_host_uri(context->upnp, task, cancellable,
+				  cb, user_data);
+		break;
+	case RSU_TASK_REMOVE_URI:
+		rsu_upnp_remove_uri(context->upnp, task, cancellable,
+				    cb, user_data);
+		break;
+	default:
+		break;
+	}
+}
+
+static void prv_batch_next_step(rsu_context_t *context, rsu_task_t *task);
+
+static void prv_batch_step_complete(rsu_task_t *step, GVariant *result,
+				    GError *error, void *user_data)
+{
+	rsu_task_t *task = user_data;
+
+	step->result = result;
+	rsu_task_batch_add_result(task, step, error);
+
+	if (error) {
+		task->batch.next = task->batch.steps->len;
+		g_error_free(error);
+	} else if (step->type == RSU_TASK_HOST_URI) {
+		g_free(task->batch.hosted_uri);
+		task->batch.hosted_uri = g_variant_dup_string(result, NULL);
+	}
+
+	prv_batch_next_step(task->batch.user_data, task);
+}
+
+/* The steps of a batch run in order and the batch stops at the first
+   step that fails.  An OpenUri step with an empty URI opens the file
+   hosted by the most recent HostFile step. */
+
+static void prv_batch_next_step(rsu_context_t *context, rsu_task_t *task)
+{
+	rsu_task_t *step;
+	GError *error;
+
+	if (task->batch.next == task->batch.steps->len) {
+		prv_async_task_complete(
+			task,
+			g_variant_ref_sink(g_variant_builder_end(
+						   task->batch.results)),
+			NULL, context);
+		goto finished;
+	}
+
+	step = g_ptr_array_index(task->batch.steps, task->batch.next++);
+
+	if (step->type == RSU_TASK_OPEN_URI && !*step->open_uri.uri) {
+		if (!task->batch.hosted_uri) {
+			error = g_error_new(RSU_ERROR, RSU_ERROR_BAD_QUERY,
+					    "No file has been hosted");
+			prv_batch_step_complete(step, NULL, error, task);
+			goto finished;
+		}
+
+		g_free(step->open_uri.uri);
+		step->open_uri.uri = g_strdup(task->batch.hosted_uri);
+	}
+
+	prv_dispatch_task(context, step, task->cancellable,
+			  prv_batch_step_complete, task);
+
+finished:
+
+	return;
+}
+
+static void prv_group_step_complete(rsu_task_t *step, GVariant *result,
+				    GError *error, void *user_data)
+{
+	rsu_task_t *task = user_data;
+
+	step->result = result;
+	rsu_task_group_add_result(task, step, error);
+
+	if (error)
+		g_error_free(error);
+
+	if (--task->group.pending == 0)
+		prv_async_task_complete(
+			task,
+			g_variant_ref_sink(g_variant_builder_end(
+						   task->group.results)),
+			NULL, task->group.user_data);
+}
+
+static void prv_group_cancelled(GCancellable *cancellable,
+				gpointer user_data)
+{
+	g_cancellable_cancel(user_data);
+}
+
+/* Each action sent on behalf of a group task is given its own
+   cancellable, so that an action that times out on one renderer does
+   not cancel the actions sent to the other renderers.  Cancelling the
+   group task cancels them all. */
+
+static GCancellable *prv_group_cancellable(rsu_task_t *task,
+					   rsu_task_t *step)
+{
+	step->cancellable = g_cancellable_new();
+	(void) g_cancellable_connect(task->cancellable,
+				     G_CALLBACK(prv_group_cancelled),
+				     g_object_ref(step->cancellable),
+				     g_object_unref);
+
+	return step->cancellable;
+}
+
+static guint prv_group_step_index(rsu_task_t *task, const gchar *path)
+{
+	rsu_task_t *step;
+	unsigned int i;
+
+	for (i = 0; i < task->group.steps->len; ++i) {
+		step = g_ptr_array_index(task->group.steps, i);
+		if (!strcmp(step->path, path))
+			break;
+	}
+
+	return i;
+}
+
+/* The start latency learnt for each renderer is a moving average of
+   the latencies measured by successive group plays.  Latencies can only
+   be measured when the position from which the renderers started is
+   known. */
+
+static void prv_group_play_learn(rsu_context_t *context, rsu_task_t *task)
+{
+	rsu_task_t *step;
+	gint64 latency;
+	gint64 *average;
+	unsigned int i;
+
+	for (i = 0; i < task->group.steps->len; ++i) {
+		if (!rsu_group_play_get_start_latency(task->group.play, i,
+						      task->group.position,
+						      &latency))
+			continue;
+
+		step = g_ptr_array_index(task->group.steps, i);
+		average = g_hash_table_lookup(context->start_latencies,
+					      step->path);
+		if (average) {
+			*average = (3 * *average + latency) / 4;
+		} else {
+			average = g_new(gint64, 1);
+			*average = latency;
+			g_hash_table_insert(context->start_latencies,
+					    g_strdup(step->path), average);
+		}
+	}
+}
+
+static void prv_group_play_finish(rsu_context_t *context, rsu_task_t *task)
+{
+	GVariant *result;
+
+	if (task->group.position >= 0)
+		prv_group_play_learn(context, task);
+
+	result = g_variant_new("(@a{s(sav)}x)",
+			       g_variant_builder_end(task->group.results),
+			       rsu_group_play_get_skew(task->group.play));
+
+	prv_async_task_complete(task, g_variant_ref_sink(result), NULL,
+				context);
+}
+
+static void prv_group_play_sample(rsu_context_t *context,
+				  rsu_task_t *task);
+
+static gboolean prv_group_play_sample_cb(gpointer user_data)
+{
+	rsu_task_t *task = user_data;
+
+	task->group.timeout_id = 0;
+	prv_group_play_sample(task->group.user_data, task);
+
+	return FALSE;
+}
+
+static void prv_group_play_sample_complete(rsu_task_t *sample,
+					   GVariant *result, GError *error,
+					   void *user_data)
+{
+	rsu_task_t *task = user_data;
+	guint index;
+
+	index = prv_group_step_index(task, sample->path);
+
+	if (error)
+		g_error_free(error);
+	else if (result && g_variant_is_of_type(result, G_VARIANT_TYPE_INT64))
+		rsu_group_play_add_sample(task->group.play, index,
+					  sample->start_time,
+					  g_get_monotonic_time(),
+					  g_variant_get_int64(result));
+
+	sample->result = result;
+	rsu_task_complete_and_delete(sample);
+
+	if (--task->group.pending)
+		goto finished;
+
+	if (++task->group.round < RSU_GROUP_PLAY_SAMPLES)
+		task->group.timeout_id = g_timeout_add(
+			RSU_GROUP_PLAY_SAMPLE_MS, prv_group_play_sample_cb,
+			task);
+	else
+		prv_group_play_finish(task->group.user_data, task);
+
+finished:
+
+	return;
+}
+
+/* Reads the position of each renderer that was started. */
+
+static void prv_group_play_sample(rsu_context_t *context, rsu_task_t *task)
+{
+	rsu_task_t *step;
+	rsu_task_t *sample;
+	GVariant *args;
+	guint count = task->group.steps->len;
+	unsigned int i;
+
+	task->group.pending = 0;
+
+	if (g_cancellable_is_cancelled(task->cancellable))
+		goto on_error;
+
+	args = g_variant_ref_sink(g_variant_new("(ss)", RSU_INTERFACE_PLAYER,
+						RSU_INTERFACE_PROP_POSITION));
+
+	for (i = 0; i < count; ++i) {
+		if (rsu_group_play_is_excluded(task->group.play, i))
+			continue;
+
+		step = g_ptr_array_index(task->group.steps, i);
+		sample = rsu_task_get_prop_new(NULL, step->path, args);
+		sample->start_time = g_get_monotonic_time();
+		++task->group.pending;
+
+		prv_dispatch_task(context, sample,
+				  prv_group_cancellable(task, sample),
+				  prv_group_play_sample_complete, task);
+	}
+
+	g_variant_unref(args);
+
+on_error:
+
+	if (!task->group.pending)
+		prv_group_play_finish(context, task);
+}
+
+static void prv_group_play_complete(rsu_task_t *step, GVariant *result,
+				    GError *error, void *user_data)
+{
+	rsu_task_t *task = user_data;
+	rsu_context_t *context = task->group.user_data;
+
+	step->result = result;
+	rsu_task_group_add_result(task, step, error);
+
+	if (error) {
+		rsu_group_play_exclude(task->group.play,
+				       prv_group_step_index(task, step->path));
+		g_error_free(error);
+	}
+
+	if (--task->group.pending)
+		goto finished;
+
+	/* The start times of the renderers can only be compared if they
+	   started from the same position. */
+
+	if (task->group.position < 0 ||
+	    g_cancellable_is_cancelled(task->cancellable)) {
+		prv_group_play_finish(context, task);
+		goto finished;
+	}
+
+	/* The renderers have all been started, so the group play no
+	   longer holds up other tasks while it measures how they
+	   started. */
+
+	prv_release_task(context, task);
+	g_ptr_array_add(context->measuring, task);
+	prv_schedule_tasks(context);
+
+	task->group.timeout_id = g_timeout_add(RSU_GROUP_PLAY_SETTLE_MS,
+					       prv_group_play_sample_cb,
+					       task);
+
+finished:
+
+	return;
+}
+
+/* Once a group play has been cancelled, Play is no longer sent to the
+   renderers that have not yet been sent it. */
+
+static void prv_group_play_cancel_unsent(rsu_task_t *task)
+{
+	rsu_task_t *step;
+	GError *error;
+	guint index;
+
+	error = g_error_new(RSU_ERROR, RSU_ERROR_CANCELLED,
+			    "Operation cancelled.");
+
+	while (rsu_group_play_next_send(task->group.play, &index) != -1) {
+		step = g_ptr_array_index(task->group.steps, index);
+		rsu_task_group_add_result(task, step, error);
+		rsu_group_play_exclude(task->group.play, index);
+		--task->group.pending;
+	}
+
+	g_error_free(error);
+}
+
+/* Sends Play to each renderer whose send time has come, and arranges
+   to be called again when the next send time is reached. */
+
+static gboolean prv_group_play_send_cb(gpointer user_data)
+{
+	rsu_task_t *task = user_data;
+	rsu_context_t *context = task->group.user_data;
+	rsu_task_t *step;
+	gint64 now = g_get_monotonic_time();
+	gint64 send_time;
+	guint index;
+
+	task->group.timeout_id = 0;
+
+	if (g_cancellable_is_cancelled(task->cancellable)) {
+		prv_group_play_cancel_unsent(task);
+		if (!task->group.pending)
+			prv_group_play_finish(context, task);
+		goto finished;
+	}
+
+	while ((send_time = rsu_group_play_next_send(task->group.play,
+						     &index)) != -1 &&
+	       send_time <= now) {
+		rsu_group_play_sent(task->group.play, index, now);
+		step = g_ptr_array_index(task->group.steps, index);
+		prv_dispatch_task(context, step,
+				  prv_group_cancellable(task, step),
+				  prv_group_play_complete, task);
+		now = g_get_monotonic_time();
+	}
+
+	if (send_time != -1)
+		task->group.timeout_id = g_timeout_add(
+			(send_time - now + 999) / 1000,
+			prv_group_play_send_cb, task);
+
+finished:
+
+	return FALSE;
+}
+
+static void prv_group_play_schedule(rsu_context_t *context,
+				    rsu_task_t *task)
+{
+	rsu_task_t *step;
+	gint64 *latency;
+	guint count = task->group.steps->len;
+	unsigned int i;
+
+	task->group.pending = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (rsu_group_play_is_excluded(task->group.play, i))
+			continue;
+
+		step = g_ptr_array_index(task->group.steps, i);
+		latency = g_hash_table_lookup(context->start_latencies,
+					      step->path);
+		rsu_group_play_set_latency(task->group.play, i,
+					   rsu_upnp_get_rtt(context->upnp,
+							    step->path),
+					   latency ? *latency : 0);
+		++task->group.pending;
+	}
+
+	if (task->group.pending) {
+		rsu_group_play_schedule(task->group.play,
+					g_get_monotonic_time());
+		(void) prv_group_play_send_cb(task);
+	} else {
+		prv_group_play_finish(context, task);
+	}
+}
+
+static void prv_group_play_seek_complete(rsu_task_t *seek, GVariant *result,
+					 GError *error, void *user_data)
+{
+	rsu_task_t *task = user_data;
+	rsu_task_t *step;
+	guint index;
+
+	if (error) {
+		index = prv_group_step_index(task, seek->path);
+		step = g_ptr_array_index(task->group.steps, index);
+		rsu_task_group_add_result(task, step, error);
+		rsu_group_play_exclude(task->group.play, index);
+		g_error_free(error);
+	}
+
+	seek->result = result;
+	rsu_task_complete_and_delete(seek);
+
+	if (--task->group.pending == 0)
+		prv_group_play_schedule(task->group.user_data, task);
+}
+
+/* A group play first moves every renderer to the requested position,
+   so that the renderers that are started together play in step. */
+
+static void prv_group_play_start(rsu_context_t *context, rsu_task_t *task)
+{
+	rsu_task_t *step;
+	rsu_task_t *seek;
+	GVariant *args;
+	guint count = task->group.steps->len;
+	unsigned int i;
+
+	rsu_group_play_new(count, &task->group.play);
+
+	if (task->group.position < 0 || !count) {
+		prv_group_play_schedule(context, task);
+		goto finished;
+	}
+
+	args = g_variant_ref_sink(g_variant_new("(ox)", RSU_OBJECT,
+						task->group.position));
+	task->group.pending = count;
+
+	for (i = 0; i < count; ++i) {
+		step = g_ptr_array_index(task->group.steps, i);
+		seek = rsu_task_set_position_new(NULL, step->path, args);
+		prv_dispatch_task(context, seek,
+				  prv_group_cancellable(task, seek),
+				  prv_group_play_seek_complete, task);
+	}
+
+	g_variant_unref(args);
+
+finished:
+
+	return;
+}
+
+/* The steps of a group task are dispatched together, so the command
+   reaches every renderer in the group at about the same time. */
+
+static void prv_group_start(rsu_context_t *context, rsu_task_t *task)
+{
+	GPtrArray *steps = task->group.steps;
+	rsu_task_t *step;
+	guint count = steps->len;
+	unsigned int i;
+
+	task->group.user_data = context;
+
+	if (task->group.synchronised) {
+		prv_group_play_start(context, task);
+		goto finished;
+	}
+
+	task->group.pending = count;
+
+	if (!count)
+		prv_async_task_complete(
+			task,
+			g_variant_ref_sink(g_variant_builder_end(
+						   task->group.results)),
+			NULL, context);
+
+	for (i = 0; i < count; ++i) {
+		step = g_ptr_array_index(steps, i);
+		prv_dispatch_task(context, step,
+				  prv_group_cancellable(task, step),
+				  prv_group_step_complete, task);
+	}
+
+finished:
+
+	return;
+}
+
+static void prv_process_async_task(rsu_context_t *context, rsu_task_t *task)
+{
+	task->cancellable = g_cancellable_new();
+	task->start_time = g_get_monotonic_time();
+
+	g_ptr_array_add(context->in_flight, task);
+
+	if (context->settings->watchdog && !context->watchdog_id)
+		context->watchdog_id = g_timeout_add_seconds(
+			context->settings->watchdog, prv_watchdog_cb,
+			context);
+
+	if (task->type == RSU_TASK_BATCH) {
+		task->batch.user_data = context;
+		prv_batch_next_step(context, task);
+	} else if (task->type == RSU_TASK_GROUP) {
+		prv_group_start(context, task);
+	} else {
+		prv_dispatch_task(context, task, task->cancellable,
+				  prv_async_task_complete, context);
+	}
+}
+
+static gboolean prv_tasks_conflict(const rsu_task_t *task,
+				   const rsu_task_t *other)
+{
+	rsu_task_t *step;
+	unsigned int i;
+	gboolean retval = FALSE;
+
+	if (other->type != RSU_TASK_GROUP) {
+		retval = rsu_task_has_path(task, other->path);
+		goto on_error;
+	}
+
+	for (i = 0; i < other->group.steps->len && !retval; ++i) {
+		step = g_ptr_array_index(other->group.steps, i);
+		retval = rsu_task_has_path(task, step->path);
+	}
+
+on_error:
+
+	return retval;
 }
 
-static void prv_process_sync_task(rsu_context_t *context, rsu_task_t *task)
+/* Returns TRUE if task must wait for earlier, a task that was started
+   or queued before it.  Only one command, i.e., a task that may change
+   the state of a renderer, runs at a time for each renderer.  Reads
+   run alongside other tasks, except that a client's read waits for
+   the client's earlier commands to the same renderer, so that it sees
+   their effects. */
+
+static gboolean prv_task_blocks(const rsu_task_t *earlier,
+				const rsu_task_t *task)
 {
-	GError *error;
+	const gchar *earlier_sender;
+	const gchar *sender;
+	gboolean retval = FALSE;
 
-	switch (task->type) {
-	case RSU_TASK_GET_VERSION:
-		rsu_task_complete_and_delete(task);
-		break;
-	case RSU_TASK_GET_SERVERS:
-		task->result = rsu_upnp_get_server_ids(context->upnp);
-		rsu_task_complete_and_delete(task);
-		break;
-	case RSU_TASK_RAISE:
-	case RSU_TASK_QUIT:
-		error = g_error_new(RSU_ERROR, RSU_ERROR_NOT_SUPPORTED,
-				    "Command not supported.");
-		rsu_task_fail_and_delete(task, error);
-		g_error_free(error);
-		break;
-	default:
-		break;
+	if (rsu_task_is_read(earlier))
+		goto on_error;
+
+	if (rsu_task_is_read(task)) {
+		earlier_sender = g_dbus_method_invocation_get_sender(
+			earlier->invocation);
+		sender = g_dbus_method_invocation_get_sender(task->invocation);
+		if (strcmp(earlier_sender, sender))
+			goto on_error;
 	}
+
+	retval = prv_tasks_conflict(earlier, task);
+
+on_error:
+
+	return retval;
 }
 
-static void prv_async_task_complete(rsu_task_t *task, GVariant *result,
-				    GError *error, void *user_data)
+/* held_before is the number of held tasks that were queued before
+   task. */
+
+static gboolean prv_can_start_task(rsu_context_t *context, rsu_task_t *task,
+				   unsigned int held_before)
 {
-	rsu_context_t *context = user_data;
+	rsu_task_t *earlier;
+	unsigned int i;
+	gboolean retval = TRUE;
 
-	g_object_unref(context->cancellable);
-	context->cancellable = NULL;
+	for (i = 0; i < context->in_flight->len && retval; ++i) {
+		earlier = g_ptr_array_index(context->in_flight, i);
+		retval = !prv_task_blocks(earlier, task);
+	}
 
-	if (error) {
-		rsu_task_fail_and_delete(task, error);
-		g_error_free(error);
-	} else {
-		task->result = result;
-		rsu_task_complete_and_delete(task);
+	for (i = 0; i < held_before && retval; ++i) {
+		earlier = g_ptr_array_index(context->held, i);
+		retval = !prv_task_blocks(earlier, task);
 	}
 
-	if (context->quitting)
-		g_main_loop_quit(context->main_loop);
-	else if (context->tasks->len > 0)
-		context->idle_id = g_idle_add(prv_process_task, context);
+	return retval;
 }
 
-static void prv_process_async_task(rsu_context_t *context, rsu_task_t *task)
+/* With pipelining enabled, a task that cannot start yet is held, in
+   the order in which it was queued, until the tasks that block it have
+   completed.  Tasks for other renderers continue to be taken from the
+   queue in the meantime. */
+
+static rsu_task_t *prv_next_held_task(rsu_context_t *context)
 {
-	context->cancellable = g_cancellable_new();
+	rsu_task_t *task = NULL;
+	unsigned int i;
 
-	switch (task->type) {
-	case RSU_TASK_GET_PROP:
-		rsu_upnp_get_prop(context->upnp, task,
-				  context->cancellable,
-				  prv_async_task_complete, context);
-		break;
-	case RSU_TASK_GET_ALL_PROPS:
-		rsu_upnp_get_all_props(context->upnp, task,
-				       context->cancellable,
-				       prv_async_task_complete, context);
-		break;
-	case RSU_TASK_PLAY:
-		rsu_upnp_play(context->upnp, task,
-			      context->cancellable,
-			      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_PAUSE:
-		rsu_upnp_pause(context->upnp, task,
-			      context->cancellable,
-			      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_PLAY_PAUSE:
-		rsu_upnp_play_pause(context->upnp, task,
-				    context->cancellable,
-				    prv_async_task_complete, context);
-		break;
-	case RSU_TASK_STOP:
-		rsu_upnp_stop(context->upnp, task,
-			      context->cancellable,
-			      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_NEXT:
-		rsu_upnp_next(context->upnp, task,
-			      context->cancellable,
-			      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_PREVIOUS:
-		rsu_upnp_previous(context->upnp, task,
-				  context->cancellable,
-				  prv_async_task_complete, context);
-		break;
-	case RSU_TASK_OPEN_URI:
-		rsu_upnp_open_uri(context->upnp, task,
-				  context->cancellable,
-				  prv_async_task_complete, context);
-		break;
-	case RSU_TASK_SEEK:
-		rsu_upnp_seek(context->upnp, task,
-			      context->cancellable,
-			      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_SET_POSITION:
-		rsu_upnp_set_position(context->upnp, task,
-				      context->cancellable,
-				      prv_async_task_complete, context);
-		break;
-	case RSU_TASK_HOST_URI:
-		rsu_upnp_host_uri(context->upnp, task,
-				  context->cancellable,
-				  prv_async_task_complete, context);
-		break;
-	case RSU_TASK_REMOVE_URI:
-		rsu_upnp_remove_uri(context->upnp, task,
-				    context->cancellable,
-				    prv_async_task_complete, context);
-		break;
-	default:
-		break;
+	for (i = 0; i < context->held->len; ++i) {
+		task = g_ptr_array_index(context->held, i);
+		if (prv_can_start_task(context, task, i))
+			break;
 	}
+
+	if (i < context->held->len)
+		(void) g_ptr_array_remove_index(context->held, i);
+	else
+		task = NULL;
+
+	return task;
 }
 
 static gboolean prv_process_task(gpointer user_data)
 {
 	rsu_context_t *context = user_data;
-	rsu_task_t *task;
+	rsu_task_t *task = NULL;
 	gboolean retval = FALSE;
 
-	if (context->tasks->len > 0) {
-		task = g_ptr_array_index(context->tasks, 0);
-		if (task->synchronous) {
-			prv_process_sync_task(context, task);
-			retval = TRUE;
-		} else {
-			prv_process_async_task(context, task);
-			context->idle_id = 0;
-		}
-		g_ptr_array_remove_index(context->tasks, 0);
-	} else {
-		context->idle_id = 0;
+	if (context->in_flight->len >= prv_max_in_flight(context))
+		goto on_error;
+
+	task = prv_next_held_task(context);
+	if (task) {
+		prv_process_async_task(context, task);
+		retval = TRUE;
+		goto on_error;
+	}
+
+	if (context->held->len < RSU_MAX_TASKS_HELD)
+		task = rsu_task_queue_pop(context->tasks);
+
+	if (!task)
+		goto on_error;
+
+	retval = TRUE;
+
+	if (task->synchronous) {
+		prv_process_sync_task(context, task);
+		goto on_error;
 	}
 
+	/* Replies are ordered by the time at which tasks leave the queue,
+	   whether they start straight away or are held. */
+
+	prv_reply_order_add(context, task);
+
+	if (prv_can_start_task(context, task, context->held->len))
+		prv_process_async_task(context, task);
+	else
+		g_ptr_array_add(context->held, task);
+
+on_error:
+
+	if (!retval)
+		context->idle_id = 0;
+
 	return retval;
 }
 
@@ -470,14 +1413,32 @@ static void prv_rsu_context_free(rsu_context_t *context)
 	if (context->watchers)
 		g_hash_table_unref(context->watchers);
 
-	if (context->tasks) {
-		g_ptr_array_foreach(context->tasks, prv_free_rsu_task_cb, NULL);
-		g_ptr_array_unref(context->tasks);
-	}
+	if (context->reads)
+		g_hash_table_unref(context->reads);
+
+	rsu_task_queue_delete(context->tasks);
 
 	if (context->idle_id)
 		(void) g_source_remove(context->idle_id);
 
+	if (context->watchdog_id)
+		(void) g_source_remove(context->watchdog_id);
+
+	if (context->held)
+		g_ptr_array_unref(context->held);
+
+	if (context->in_flight)
+		g_ptr_array_unref(context->in_flight);
+
+	if (context->measuring)
+		g_ptr_array_unref(context->measuring);
+
+	if (context->replies)
+		g_hash_table_unref(context->replies);
+
+	if (context->start_latencies)
+		g_hash_table_unref(context->start_latencies);
+
 	if (context->sig_id)
 		(void) g_source_remove(context->sig_id);
 
@@ -485,6 +1446,10 @@ static void prv_rsu_context_free(rsu_context_t *context)
 		if (context->rsu_id)
 			g_dbus_connection_unregister_object(context->connection,
 							    context->rsu_id);
+		if (context->object_manager_id)
+			g_dbus_connection_unregister_object(
+				context->connection,
+				context->object_manager_id);
 	}
 
 	if (context->main_loop)
@@ -501,13 +1466,26 @@ static void prv_rsu_context_free(rsu_context_t *context)
 
 	if (context->root_node_info)
 		g_dbus_node_info_unref(context->root_node_info);
+
+	if (context->settings)
+		rsu_settings_delete(context->settings);
 }
 
 static void prv_quit(rsu_context_t *context)
 {
-	if (context->cancellable) {
-		g_cancellable_cancel(context->cancellable);
+	rsu_task_t *task;
+	unsigned int i;
+
+	if (context->in_flight->len || context->measuring->len) {
 		context->quitting = TRUE;
+		for (i = 0; i < context->in_flight->len; ++i) {
+			task = g_ptr_array_index(context->in_flight, i);
+			g_cancellable_cancel(task->cancellable);
+		}
+		for (i = 0; i < context->measuring->len; ++i) {
+			task = g_ptr_array_index(context->measuring, i);
+			g_cancellable_cancel(task->cancellable);
+		}
 	} else {
 		g_main_loop_quit(context->main_loop);
 	}
@@ -528,10 +1506,80 @@ static void prv_lost_client(GDBusConnection *connection, const gchar *name,
 	prv_remove_client(user_data, name);
 }
 
+static gboolean prv_read_on_path(gpointer key, gpointer value,
+				 gpointer user_data)
+{
+	rsu_task_t *task = value;
+
+	return !strcmp(task->path, user_data);
+}
+
+static void prv_forget_reads(rsu_context_t *context, rsu_task_t *task)
+{
+	rsu_task_t *step;
+	unsigned int i;
+
+	if (task->type == RSU_TASK_GROUP) {
+		for (i = 0; i < task->group.steps->len; ++i) {
+			step = g_ptr_array_index(task->group.steps, i);
+			(void) g_hash_table_foreach_remove(context->reads,
+							   prv_read_on_path,
+							   step->path);
+		}
+	} else if (task->path) {
+		(void) g_hash_table_foreach_remove(context->reads,
+						   prv_read_on_path,
+						   task->path);
+	}
+}
+
+/* A read task that is identical to one that is queued or in progress
+   is attached to the earlier task and completes with it.  Reads are
+   not attached to tasks queued before a command to the same renderer,
+   as they would not see the command's effects. */
+
+static gboolean prv_share_read_task(rsu_context_t *context, rsu_task_t *task)
+{
+	gchar *key;
+	rsu_task_t *leader;
+	gboolean retval = FALSE;
+
+	key = prv_read_task_key(context, task);
+
+	if (!key) {
+		prv_forget_reads(context, task);
+		goto on_error;
+	}
+
+	leader = g_hash_table_lookup(context->reads, key);
+
+	if (leader) {
+		rsu_task_add_follower(leader, task);
+		retval = TRUE;
+	}
+
+	g_free(key);
+
+on_error:
+
+	return retval;
+}
+
+static void prv_register_read_task(rsu_context_t *context, rsu_task_t *task)
+{
+	gchar *key;
+
+	key = prv_read_task_key(context, task);
+	if (key)
+		g_hash_table_insert(context->reads, key, task);
+}
+
 static void prv_add_task(rsu_context_t *context, rsu_task_t *task)
 {
 	const gchar *client_name;
 	guint watcher_id;
+	rsu_task_t *superseded;
+	GError *error;
 
 	client_name = g_dbus_method_invocation_get_sender(task->invocation);
 
@@ -545,10 +1593,167 @@ static void prv_add_task(rsu_context_t *context, rsu_task_t *task)
 				    GUINT_TO_POINTER(watcher_id));
 	}
 
-	if (!context->cancellable && !context->idle_id)
-		context->idle_id = g_idle_add(prv_process_task, context);
+	if (prv_share_read_task(context, task))
+		goto on_error;
+
+	if (!rsu_task_queue_push(context->tasks, task, &superseded)) {
+		error = g_error_new(RSU_ERROR, RSU_ERROR_BUSY,
+				    "Too many requests queued");
+		rsu_task_fail_and_delete(task, error);
+		g_error_free(error);
+		goto on_error;
+	}
+
+	prv_register_read_task(context, task);
+
+	prv_schedule_tasks(context);
+
+	if (superseded) {
+		g_debug("Queued %s on %s superseded by %s",
+			g_dbus_method_invocation_get_method_name(
+				superseded->invocation),
+			task->path,
+			g_dbus_method_invocation_get_method_name(
+				task->invocation));
+		superseded->done = TRUE;
+		prv_reply_order_add(context, superseded);
+		prv_reply_order_flush(context, superseded);
+	}
+
+on_error:
+
+	return;
+}
+
+static gboolean prv_args_are(GVariant *args, const gchar *type)
+{
+	return g_variant_is_of_type(args, G_VARIANT_TYPE(type));
+}
+
+static GVariant *prv_command_args_new(GVariant *values)
+{
+	GVariant **args;
+	GVariant *retval;
+	gsize count;
+	gsize i;
+
+	count = g_variant_n_children(values);
+	args = g_new(GVariant *, count);
+
+	for (i = 0; i < count; ++i)
+		g_variant_get_child(values, i, "v", &args[i]);
+
+	retval = g_variant_ref_sink(g_variant_new_tuple(args, count));
+
+	for (i = 0; i < count; ++i)
+		g_variant_unref(args[i]);
+	g_free(args);
+
+	return retval;
+}
+
+/* Creates the task for one of the commands of a batch or group
+   command, or returns NULL if method cannot be used in one of these or
+   values are not the method's arguments. */
+
+static rsu_task_t *prv_command_task_new(GDBusMethodInvocation *invocation,
+					const gchar *object,
+					const gchar *method, GVariant *values)
+{
+	rsu_task_t *step = NULL;
+	GVariant *args = prv_command_args_new(values);
+
+	if (!strcmp(method, RSU_INTERFACE_PLAY) && prv_args_are(args, "()"))
+		step = rsu_task_play_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_PAUSE) &&
+		 prv_args_are(args, "()"))
+		step = rsu_task_pause_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_PLAY_PAUSE) &&
+		 prv_args_are(args, "()"))
+		step = rsu_task_play_pause_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_STOP) &&
+		 prv_args_are(args, "()"))
+		step = rsu_task_stop_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_NEXT) &&
+		 prv_args_are(args, "()"))
+		step = rsu_task_next_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_PREVIOUS) &&
+		 prv_args_are(args, "()"))
+		step = rsu_task_previous_new(invocation, object);
+	else if (!strcmp(method, RSU_INTERFACE_OPEN_URI) &&
+		 prv_args_are(args, "(s)"))
+		step = rsu_task_open_uri_new(invocation, object, args);
+	else if (!strcmp(method, RSU_INTERFACE_SEEK) &&
+		 prv_args_are(args, "(x)"))
+		step = rsu_task_seek_new(invocation, object, args);
+	else if (!strcmp(method, RSU_INTERFACE_SET_POSITION) &&
+		 prv_args_are(args, "(ox)"))
+		step = rsu_task_set_position_new(invocation, object, args);
+	else if (!strcmp(method, RSU_INTERFACE_HOST_FILE) &&
+		 prv_args_are(args, "(s)"))
+		step = rsu_task_host_uri_new(invocation, object, args);
+	else if (!strcmp(method, RSU_INTERFACE_REMOVE_FILE) &&
+		 prv_args_are(args, "(s)"))
+		step = rsu_task_remove_uri_new(invocation, object, args);
+
+	g_variant_unref(args);
+
+	return step;
+}
+
+static rsu_task_t *prv_group_task_new(GDBusMethodInvocation *invocation,
+				      GVariant *parameters)
+{
+	rsu_task_t *task;
+	rsu_task_t *step;
+	GVariantIter *iter;
+	const gchar *path;
+	const gchar *command;
+	GVariant *values;
+	GError *error;
+
+	task = rsu_task_group_new(invocation);
+
+	g_variant_get(parameters, "(as&s@av)", &iter, &command, &values);
+
+	while (g_variant_iter_next(iter, "&s", &path)) {
+		step = prv_command_task_new(invocation, path, command, values);
+
+		if (!step) {
+			error = g_error_new(RSU_ERROR, RSU_ERROR_BAD_QUERY,
+					    "Invalid group command %s",
+					    command);
+			rsu_task_fail_and_delete(task, error);
+			g_error_free(error);
+			task = NULL;
+			break;
+		}
+
+		(void) rsu_task_group_add_step(task, step);
+	}
+
+	g_variant_iter_free(iter);
+	g_variant_unref(values);
+
+	return task;
+}
+
+static rsu_task_t *prv_group_play_task_new(GDBusMethodInvocation *invocation,
+					   GVariant *parameters)
+{
+	rsu_task_t *task;
+	GVariantIter *iter;
+	const gchar *path;
+
+	task = rsu_task_group_play_new(invocation, parameters);
 
-	g_ptr_array_add(context->tasks, task);
+	g_variant_get_child(parameters, 0, "as", &iter);
+	while (g_variant_iter_next(iter, "&s", &path))
+		(void) rsu_task_group_add_step(
+			task, rsu_task_play_new(invocation, path));
+	g_variant_iter_free(iter);
+
+	return task;
 }
 
 static void prv_rsu_method_call(GDBusConnection *conn,
@@ -571,9 +1776,25 @@ static void prv_rsu_method_call(GDBusConnection *conn,
 			task = rsu_task_get_version_new(invocation);
 		else if (!strcmp(method, RSU_INTERFACE_GET_SERVERS))
 			task = rsu_task_get_servers_new(invocation);
+		else if (!strcmp(method,
+				 RSU_INTERFACE_GET_SERVERS_WITH_PROPERTIES))
+			task = rsu_task_get_servers_with_props_new(invocation);
+		else if (!strcmp(method, RSU_INTERFACE_GET_HOST_STATISTICS))
+			task = rsu_task_get_host_statistics_new(invocation);
+		else if (!strcmp(method, RSU_INTERFACE_GET_FILTER))
+			task = rsu_task_get_filter_new(invocation);
+		else if (!strcmp(method, RSU_INTERFACE_SET_FILTER))
+			task = rsu_task_set_filter_new(invocation, parameters);
+		else if (!strcmp(method, RSU_INTERFACE_GROUP_COMMAND))
+			task = prv_group_task_new(invocation, parameters);
+		else if (!strcmp(method, RSU_INTERFACE_GROUP_PLAY))
+			task = prv_group_play_task_new(invocation, parameters);
 		else
 			goto finished;
 
+		if (!task)
+			goto finished;
+
 		prv_add_task(context, task);
 	}
 
@@ -582,6 +1803,22 @@ finished:
 	return;
 }
 
+static void prv_object_manager_method_call(GDBusConnection *conn,
+					   const gchar *sender,
+					   const gchar *object,
+					   const gchar *interface,
+					   const gchar *method,
+					   GVariant *parameters,
+					   GDBusMethodInvocation *invocation,
+					   gpointer user_data)
+{
+	rsu_context_t *context = user_data;
+
+	if (!strcmp(method, RSU_INTERFACE_GET_MANAGED_OBJECTS))
+		prv_add_task(context,
+			     rsu_task_get_managed_objects_new(invocation));
+}
+
 static void prv_props_method_call(GDBusConnection *conn,
 				  const gchar *sender,
 				  const gchar *object,
@@ -703,9 +1940,74 @@ on_error:
 	return;
 }
 
+static void prv_rsu_renderer_device_method_call(
+	GDBusConnection *conn,
+	const gchar *sender,
+	const gchar *object,
+	const gchar *interface,
+	const gchar *method,
+	GVariant *parameters,
+	GDBusMethodInvocation *invocation,
+	gpointer user_data)
+{
+	rsu_context_t *context = user_data;
+	rsu_task_t *task;
+	rsu_task_t *step;
+	GVariantIter *iter;
+	const gchar *command;
+	GVariant *values;
+	GError *error;
+
+	if (!strcmp(method, RSU_INTERFACE_GET_PROPERTIES)) {
+		task = rsu_task_get_selected_props_new(invocation, object,
+						       parameters);
+		prv_add_task(context, task);
+		goto finished;
+	}
+
+	if (!strcmp(method, RSU_INTERFACE_GET_CHANGES_SINCE)) {
+		task = rsu_task_get_changes_new(invocation, object,
+						parameters);
+		prv_add_task(context, task);
+		goto finished;
+	}
+
+	if (strcmp(method, RSU_INTERFACE_BATCH))
+		goto finished;
+
+	task = rsu_task_batch_new(invocation, object);
+
+	g_variant_get(parameters, "(a(sav))", &iter);
+	while (g_variant_iter_next(iter, "(&s@av)", &command, &values)) {
+		step = prv_command_task_new(invocation, object, command,
+					    values);
+		g_variant_unref(values);
+
+		if (!step) {
+			error = g_error_new(RSU_ERROR, RSU_ERROR_BAD_QUERY,
+					    "Invalid batch command %s",
+					    command);
+			rsu_task_fail_and_delete(task, error);
+			g_error_free(error);
+			g_variant_iter_free(iter);
+			goto finished;
+		}
+
+		rsu_task_batch_add_step(task, step);
+	}
+	g_variant_iter_free(iter);
+
+	prv_add_task(context, task);
+
+finished:
+
+	return;
+}
+
 static void prv_found_media_server(const gchar *path, void *user_data)
 {
 	rsu_context_t *context = user_data;
+	GVariant *interfaces;
 
 	(void) g_dbus_connection_emit_signal(context->connection,
 					     NULL,
@@ -714,11 +2016,28 @@ static void prv_found_media_server(const gchar *path, void *user_data)
 					     RSU_INTERFACE_FOUND_SERVER,
 					     g_variant_new("(s)", path),
 					     NULL);
+
+	interfaces = rsu_upnp_get_server_interfaces(context->upnp, path);
+	if (interfaces) {
+		(void) g_dbus_connection_emit_signal(
+			context->connection, NULL, RSU_OBJECT,
+			RSU_INTERFACE_OBJECT_MANAGER,
+			RSU_INTERFACE_INTERFACES_ADDED,
+			g_variant_new("(o@a{sa{sv}})", path, interfaces),
+			NULL);
+		g_variant_unref(interfaces);
+	}
 }
 
+/* The interfaces listed by InterfacesRemoved are those registered on
+   each server object, less org.freedesktop.DBus.Properties. */
+
 static void prv_lost_media_server(const gchar *path, void *user_data)
 {
 	rsu_context_t *context = user_data;
+	GVariantBuilder vb;
+	GVariant *interfaces;
+	unsigned int i;
 
 	(void) g_dbus_connection_emit_signal(context->connection,
 					     NULL,
@@ -727,6 +2046,23 @@ static void prv_lost_media_server(const gchar *path, void *user_data)
 					     RSU_INTERFACE_LOST_SERVER,
 					     g_variant_new("(s)", path),
 					     NULL);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("as"));
+	for (i = 0; i < RSU_INTERFACE_INFO_MAX; ++i)
+		if (i != RSU_INTERFACE_INFO_PROPERTIES)
+			g_variant_builder_add(
+				&vb, "s",
+				context->server_node_info->interfaces[i]->name);
+	interfaces = g_variant_builder_end(&vb);
+
+	(void) g_dbus_connection_emit_signal(context->connection,
+					     NULL,
+					     RSU_OBJECT,
+					     RSU_INTERFACE_OBJECT_MANAGER,
+					     RSU_INTERFACE_INTERFACES_REMOVED,
+					     g_variant_new("(o@as)", path,
+							   interfaces),
+					     NULL);
 }
 
 static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
@@ -745,7 +2081,15 @@ static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
 						  &g_rsu_vtable,
 						  user_data, NULL, NULL);
 
-	if (!context->rsu_id) {
+	if (context->rsu_id)
+		context->object_manager_id =
+			g_dbus_connection_register_object(
+				connection, RSU_OBJECT,
+				context->root_node_info->interfaces[1],
+				&g_object_manager_vtable, user_data, NULL,
+				NULL);
+
+	if (!context->rsu_id || !context->object_manager_id) {
 		context->error = true;
 		g_main_loop_quit(context->main_loop);
 	} else {
@@ -757,7 +2101,8 @@ static void prv_bus_acquired(GDBusConnection *connection, const gchar *name,
 			info[i].vtable = g_server_vtables[i];
 		}
 
-		context->upnp = rsu_upnp_new(connection, info,
+		context->upnp = rsu_upnp_new(connection, context->settings,
+					     info,
 					     prv_found_media_server,
 					     prv_lost_media_server,
 					     user_data);
@@ -844,6 +2189,13 @@ int main(int argc, char *argv[])
 
 	g_type_init();
 
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+#endif
+
+	rsu_settings_new(&context.settings);
+
 	context.root_node_info =
 		g_dbus_node_info_new_for_xml(g_rsu_root_introspection, NULL);
 
@@ -864,7 +2216,18 @@ int main(int argc, char *argv[])
 					  prv_bus_acquired, NULL,
 					  prv_name_lost, &context, NULL);
 
-	context.tasks = g_ptr_array_new();
+	rsu_task_queue_new(context.settings, &context.tasks);
+	context.reads = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+	context.in_flight = g_ptr_array_new();
+	context.measuring = g_ptr_array_new();
+	context.held = g_ptr_array_new_with_free_func(
+		(GDestroyNotify) rsu_task_delete);
+	context.replies = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, prv_reply_order_free);
+	context.start_latencies = g_hash_table_new_full(g_str_hash,
+							g_str_equal,
+							g_free, g_free);
 
 	context.watchers = g_hash_table_new_full(g_str_hash, g_str_equal,
 						 g_free, prv_unregister_client);
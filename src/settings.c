@@ -0,0 +1,313 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "settings.h"
+
+#define RSU_SETTINGS_FILE "renderer-service-upnp.conf"
+
+#define RSU_SETTINGS_GROUP_HOST_SERVICE "host-service"
+#define RSU_SETTINGS_KEY_SCALE_IMAGES "scale-images"
+#define RSU_SETTINGS_KEY_FAN_OUT "fan-out"
+
+#define RSU_SETTINGS_GROUP_DISCOVERY "discovery"
+#define RSU_SETTINGS_KEY_MAX_FETCHES "max-fetches"
+#define RSU_SETTINGS_KEY_FETCH_TIMEOUT "fetch-timeout"
+#define RSU_SETTINGS_KEY_CACHE_EXPIRY "cache-expiry"
+#define RSU_SETTINGS_KEY_GRACE_PERIOD "grace-period"
+#define RSU_SETTINGS_KEY_PROBE_TIMEOUT "probe-timeout"
+
+#define RSU_SETTINGS_GROUP_EVENTING "eventing"
+#define RSU_SETTINGS_KEY_SUBSCRIPTION_TIMEOUT "subscription-timeout"
+
+#define RSU_SETTINGS_GROUP_TIMEOUTS "timeouts"
+#define RSU_SETTINGS_KEY_ACTION_TIMEOUT "action-timeout"
+#define RSU_SETTINGS_KEY_WATCHDOG "watchdog"
+
+#define RSU_SETTINGS_GROUP_QUEUE "queue"
+#define RSU_SETTINGS_KEY_MAX_CLIENT_TASKS "max-client-tasks"
+#define RSU_SETTINGS_KEY_PIPELINING "pipelining"
+
+#define RSU_SETTINGS_GROUP_FILTER "filter"
+#define RSU_SETTINGS_KEY_INTERFACES "interfaces"
+#define RSU_SETTINGS_KEY_SUBNETS "subnets"
+#define RSU_SETTINGS_KEY_ALLOW_UDNS "allow-udns"
+#define RSU_SETTINGS_KEY_DENY_UDNS "deny-udns"
+#define RSU_SETTINGS_KEY_ALLOW_MANUFACTURERS "allow-manufacturers"
+#define RSU_SETTINGS_KEY_DENY_MANUFACTURERS "deny-manufacturers"
+#define RSU_SETTINGS_KEY_ALLOW_MODELS "allow-models"
+#define RSU_SETTINGS_KEY_DENY_MODELS "deny-models"
+
+#define RSU_SETTINGS_DEFAULT_SCALE_IMAGES TRUE
+#define RSU_SETTINGS_DEFAULT_FAN_OUT FALSE
+#define RSU_SETTINGS_DEFAULT_MAX_FETCHES 8
+#define RSU_SETTINGS_DEFAULT_FETCH_TIMEOUT 10
+#define RSU_SETTINGS_DEFAULT_CACHE_EXPIRY 15
+#define RSU_SETTINGS_DEFAULT_GRACE_PERIOD 10
+#define RSU_SETTINGS_DEFAULT_PROBE_TIMEOUT 5
+#define RSU_SETTINGS_DEFAULT_SUBSCRIPTION_TIMEOUT 300
+#define RSU_SETTINGS_DEFAULT_ACTION_TIMEOUT 20
+#define RSU_SETTINGS_DEFAULT_WATCHDOG 30
+#define RSU_SETTINGS_DEFAULT_MAX_CLIENT_TASKS 64
+#define RSU_SETTINGS_DEFAULT_PIPELINING FALSE
+
+static gboolean prv_get_boolean(GKeyFile *keyfile, const gchar *group,
+				const gchar *key, gboolean default_value)
+{
+	GError *error = NULL;
+	gboolean retval;
+
+	retval = g_key_file_get_boolean(keyfile, group, key, &error);
+
+	if (error) {
+		g_error_free(error);
+		retval = default_value;
+	}
+
+	return retval;
+}
+
+static guint prv_get_uint(GKeyFile *keyfile, const gchar *group,
+			  const gchar *key, guint min_value,
+			  guint default_value)
+{
+	GError *error = NULL;
+	gint value;
+	guint retval = default_value;
+
+	value = g_key_file_get_integer(keyfile, group, key, &error);
+
+	if (error)
+		g_error_free(error);
+	else if (value >= (gint) min_value)
+		retval = value;
+
+	return retval;
+}
+
+static gchar **prv_get_string_list(GKeyFile *keyfile, const gchar *group,
+				   const gchar *key)
+{
+	gchar **retval;
+	unsigned int i;
+
+	retval = g_key_file_get_string_list(keyfile, group, key, NULL, NULL);
+
+	if (retval)
+		for (i = 0; retval[i]; ++i)
+			g_strstrip(retval[i]);
+
+	return retval;
+}
+
+static void prv_settings_init(rsu_settings_t *settings)
+{
+	settings->scale_images = RSU_SETTINGS_DEFAULT_SCALE_IMAGES;
+	settings->fan_out = RSU_SETTINGS_DEFAULT_FAN_OUT;
+	settings->max_fetches = RSU_SETTINGS_DEFAULT_MAX_FETCHES;
+	settings->fetch_timeout = RSU_SETTINGS_DEFAULT_FETCH_TIMEOUT;
+	settings->cache_expiry = RSU_SETTINGS_DEFAULT_CACHE_EXPIRY;
+	settings->grace_period = RSU_SETTINGS_DEFAULT_GRACE_PERIOD;
+	settings->probe_timeout = RSU_SETTINGS_DEFAULT_PROBE_TIMEOUT;
+	settings->subscription_timeout =
+		RSU_SETTINGS_DEFAULT_SUBSCRIPTION_TIMEOUT;
+	settings->action_timeout = RSU_SETTINGS_DEFAULT_ACTION_TIMEOUT;
+	settings->action_timeouts = g_hash_table_new_full(g_str_hash,
+							  g_str_equal,
+							  g_free, NULL);
+	settings->watchdog = RSU_SETTINGS_DEFAULT_WATCHDOG;
+	settings->max_client_tasks = RSU_SETTINGS_DEFAULT_MAX_CLIENT_TASKS;
+	settings->pipelining = RSU_SETTINGS_DEFAULT_PIPELINING;
+}
+
+/* Apart from action-timeout and watchdog, each key of the timeouts
+   group is the name of a UPnP action whose timeout differs from the
+   default. */
+
+static void prv_load_action_timeouts(rsu_settings_t *settings,
+				     GKeyFile *keyfile)
+{
+	gchar **keys;
+	unsigned int i;
+
+	keys = g_key_file_get_keys(keyfile, RSU_SETTINGS_GROUP_TIMEOUTS,
+				   NULL, NULL);
+	if (!keys)
+		goto on_error;
+
+	for (i = 0; keys[i]; ++i) {
+		if (!strcmp(keys[i], RSU_SETTINGS_KEY_ACTION_TIMEOUT) ||
+		    !strcmp(keys[i], RSU_SETTINGS_KEY_WATCHDOG))
+			continue;
+
+		g_hash_table_insert(settings->action_timeouts,
+				    g_strdup(keys[i]),
+				    GUINT_TO_POINTER(prv_get_uint(
+					    keyfile,
+					    RSU_SETTINGS_GROUP_TIMEOUTS,
+					    keys[i], 0,
+					    settings->action_timeout)));
+	}
+
+	g_strfreev(keys);
+
+on_error:
+
+	return;
+}
+
+static void prv_settings_load(rsu_settings_t *settings, GKeyFile *keyfile)
+{
+	settings->scale_images = prv_get_boolean(
+		keyfile, RSU_SETTINGS_GROUP_HOST_SERVICE,
+		RSU_SETTINGS_KEY_SCALE_IMAGES,
+		settings->scale_images);
+
+	settings->fan_out = prv_get_boolean(
+		keyfile, RSU_SETTINGS_GROUP_HOST_SERVICE,
+		RSU_SETTINGS_KEY_FAN_OUT, settings->fan_out);
+
+	settings->max_fetches = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_DISCOVERY,
+		RSU_SETTINGS_KEY_MAX_FETCHES, 1, settings->max_fetches);
+
+	settings->fetch_timeout = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_DISCOVERY,
+		RSU_SETTINGS_KEY_FETCH_TIMEOUT, 1, settings->fetch_timeout);
+
+	settings->cache_expiry = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_DISCOVERY,
+		RSU_SETTINGS_KEY_CACHE_EXPIRY, 0, settings->cache_expiry);
+
+	settings->grace_period = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_DISCOVERY,
+		RSU_SETTINGS_KEY_GRACE_PERIOD, 0, settings->grace_period);
+
+	settings->probe_timeout = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_DISCOVERY,
+		RSU_SETTINGS_KEY_PROBE_TIMEOUT, 0, settings->probe_timeout);
+
+	settings->subscription_timeout = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_EVENTING,
+		RSU_SETTINGS_KEY_SUBSCRIPTION_TIMEOUT, 0,
+		settings->subscription_timeout);
+
+	settings->action_timeout = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_TIMEOUTS,
+		RSU_SETTINGS_KEY_ACTION_TIMEOUT, 0, settings->action_timeout);
+
+	settings->watchdog = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_TIMEOUTS,
+		RSU_SETTINGS_KEY_WATCHDOG, 0, settings->watchdog);
+
+	prv_load_action_timeouts(settings, keyfile);
+
+	settings->max_client_tasks = prv_get_uint(
+		keyfile, RSU_SETTINGS_GROUP_QUEUE,
+		RSU_SETTINGS_KEY_MAX_CLIENT_TASKS, 0,
+		settings->max_client_tasks);
+
+	settings->pipelining = prv_get_boolean(
+		keyfile, RSU_SETTINGS_GROUP_QUEUE,
+		RSU_SETTINGS_KEY_PIPELINING, settings->pipelining);
+
+	settings->interfaces = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_INTERFACES);
+	settings->subnets = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_SUBNETS);
+	settings->allow_udns = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_ALLOW_UDNS);
+	settings->deny_udns = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_DENY_UDNS);
+	settings->allow_manufacturers = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_ALLOW_MANUFACTURERS);
+	settings->deny_manufacturers = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_DENY_MANUFACTURERS);
+	settings->allow_models = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_ALLOW_MODELS);
+	settings->deny_models = prv_get_string_list(
+		keyfile, RSU_SETTINGS_GROUP_FILTER,
+		RSU_SETTINGS_KEY_DENY_MODELS);
+}
+
+void rsu_settings_new(rsu_settings_t **settings)
+{
+	rsu_settings_t *s = g_new0(rsu_settings_t, 1);
+	GKeyFile *keyfile;
+	gchar *path;
+
+	prv_settings_init(s);
+
+	keyfile = g_key_file_new();
+	path = g_build_filename(g_get_user_config_dir(), RSU_SETTINGS_FILE,
+				NULL);
+
+	/* The settings file is optional.  If it cannot be read we
+	   simply use the default values. */
+
+	if (g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL))
+		prv_settings_load(s, keyfile);
+
+	g_free(path);
+	g_key_file_free(keyfile);
+
+	*settings = s;
+}
+
+void rsu_settings_delete(rsu_settings_t *settings)
+{
+	if (settings) {
+		g_strfreev(settings->interfaces);
+		g_strfreev(settings->subnets);
+		g_strfreev(settings->allow_udns);
+		g_strfreev(settings->deny_udns);
+		g_strfreev(settings->allow_manufacturers);
+		g_strfreev(settings->deny_manufacturers);
+		g_strfreev(settings->allow_models);
+		g_strfreev(settings->deny_models);
+		g_hash_table_unref(settings->action_timeouts);
+		g_free(settings);
+	}
+}
+
+guint rsu_settings_get_action_timeout(const rsu_settings_t *settings,
+				      const gchar *action_name)
+{
+	gpointer value;
+	guint retval = settings->action_timeout;
+
+	if (g_hash_table_lookup_extended(settings->action_timeouts,
+					 action_name, NULL, &value))
+		retval = GPOINTER_TO_UINT(value);
+
+	return retval;
+}
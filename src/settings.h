@@ -0,0 +1,58 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef RSU_SETTINGS_H__
+#define RSU_SETTINGS_H__
+
+#include <glib.h>
+
+typedef struct rsu_settings_t_ rsu_settings_t;
+struct rsu_settings_t_ {
+	gboolean scale_images;
+	gboolean fan_out;
+	guint max_fetches;
+	guint fetch_timeout;
+	guint cache_expiry;
+	guint grace_period;
+	guint probe_timeout;
+	guint subscription_timeout;
+	guint action_timeout;
+	GHashTable *action_timeouts;
+	guint watchdog;
+	guint max_client_tasks;
+	gboolean pipelining;
+	gchar **interfaces;
+	gchar **subnets;
+	gchar **allow_udns;
+	gchar **deny_udns;
+	gchar **allow_manufacturers;
+	gchar **deny_manufacturers;
+	gchar **allow_models;
+	gchar **deny_models;
+};
+
+void rsu_settings_new(rsu_settings_t **settings);
+void rsu_settings_delete(rsu_settings_t *settings);
+guint rsu_settings_get_action_timeout(const rsu_settings_t *settings,
+				      const gchar *action_name);
+
+#endif
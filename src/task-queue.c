@@ -0,0 +1,238 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include "task-queue.h"
+
+/* Tasks are queued by priority class, and the highest class with a
+   queued task is normally served first.  So that a steady stream of
+   higher priority tasks cannot starve the lower classes, a class that
+   has been passed over g_starvation_limit times while it had tasks
+   waiting is served next.
+
+   Within a class each client, identified by its D-Bus unique name,
+   has its own queue, and the clients with tasks in the class are
+   served in turn.  A client that floods the daemon with requests
+   therefore only delays its own requests.  The number of tasks each
+   client may have queued is limited. */
+
+static const guint g_starvation_limit[RSU_TASK_PRIORITY_MAX] = {
+	0,
+	8,
+	16
+};
+
+typedef struct rsu_task_queue_client_t_ rsu_task_queue_client_t;
+struct rsu_task_queue_client_t_ {
+	gchar *name;
+	GQueue tasks[RSU_TASK_PRIORITY_MAX];
+	guint count;
+};
+
+struct rsu_task_queue_t_ {
+	guint max_client_tasks;
+	GHashTable *clients;
+	GQueue ready[RSU_TASK_PRIORITY_MAX];
+	guint passed[RSU_TASK_PRIORITY_MAX];
+};
+
+static void prv_task_queue_client_delete(gpointer data)
+{
+	rsu_task_queue_client_t *client = data;
+	rsu_task_t *task;
+	unsigned int i;
+
+	for (i = 0; i < RSU_TASK_PRIORITY_MAX; ++i)
+		while ((task = g_queue_pop_head(&client->tasks[i])))
+			rsu_task_delete(task);
+
+	g_free(client->name);
+	g_free(client);
+}
+
+void rsu_task_queue_new(const rsu_settings_t *settings,
+			rsu_task_queue_t **queue)
+{
+	rsu_task_queue_t *q = g_new0(rsu_task_queue_t, 1);
+	unsigned int i;
+
+	q->max_client_tasks = settings->max_client_tasks;
+	q->clients = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					   prv_task_queue_client_delete);
+
+	for (i = 0; i < RSU_TASK_PRIORITY_MAX; ++i)
+		g_queue_init(&q->ready[i]);
+
+	*queue = q;
+}
+
+void rsu_task_queue_delete(rsu_task_queue_t *queue)
+{
+	unsigned int i;
+
+	if (queue) {
+		for (i = 0; i < RSU_TASK_PRIORITY_MAX; ++i)
+			g_queue_clear(&queue->ready[i]);
+
+		g_hash_table_unref(queue->clients);
+		g_free(queue);
+	}
+}
+
+/* Clients scrubbing a seek bar or hammering transport controls can
+   queue many commands for a renderer, of which only the last
+   matters.  If the last task the client has queued for the renderer
+   in the same class is made redundant by the new one, the new task
+   takes its place in the queue.  Group tasks count as tasks for each
+   of their renderers, so a task is never moved ahead of a group task
+   that acts on the same renderer. */
+
+static rsu_task_t *prv_task_queue_supersede(GQueue *tasks, rsu_task_t *task)
+{
+	GList *link;
+	rsu_task_t *prev;
+	rsu_task_t *retval = NULL;
+
+	if (!task->path)
+		goto on_error;
+
+	for (link = tasks->tail; link; link = link->prev) {
+		prev = link->data;
+		if (rsu_task_has_path(prev, task->path))
+			break;
+	}
+
+	if (link && rsu_task_supersedes(task, prev)) {
+		link->data = task;
+		retval = prev;
+	}
+
+on_error:
+
+	return retval;
+}
+
+/* Returns FALSE, without queuing task, if its client already has the
+   maximum number of tasks queued.  If task supersedes a queued task,
+   the queued task is removed from the queue and returned in
+   superseded so that the caller can complete it. */
+
+gboolean rsu_task_queue_push(rsu_task_queue_t *queue, rsu_task_t *task,
+			     rsu_task_t **superseded)
+{
+	const gchar *name;
+	rsu_task_queue_client_t *client;
+	GQueue *tasks;
+	gboolean retval = FALSE;
+
+	name = g_dbus_method_invocation_get_sender(task->invocation);
+	client = g_hash_table_lookup(queue->clients, name);
+
+	if (!client) {
+		client = g_new0(rsu_task_queue_client_t, 1);
+		client->name = g_strdup(name);
+		g_hash_table_insert(queue->clients, client->name, client);
+	}
+
+	tasks = &client->tasks[task->priority];
+	*superseded = prv_task_queue_supersede(tasks, task);
+
+	if (!*superseded) {
+		if (queue->max_client_tasks &&
+		    client->count >= queue->max_client_tasks)
+			goto on_error;
+
+		if (g_queue_is_empty(tasks))
+			g_queue_push_tail(&queue->ready[task->priority],
+					  client);
+
+		g_queue_push_tail(tasks, task);
+		++client->count;
+	}
+
+	retval = TRUE;
+
+on_error:
+
+	return retval;
+}
+
+rsu_task_t *rsu_task_queue_pop(rsu_task_queue_t *queue)
+{
+	rsu_task_priority_t chosen = RSU_TASK_PRIORITY_MAX;
+	rsu_task_priority_t i;
+	rsu_task_queue_client_t *client;
+	rsu_task_t *task = NULL;
+
+	/* Serve the lowest starving class, if any, otherwise the
+	   highest non-empty class. */
+
+	for (i = RSU_TASK_PRIORITY_MAX; i > 0; --i) {
+		if (g_queue_is_empty(&queue->ready[i - 1]))
+			continue;
+
+		chosen = i - 1;
+		if (queue->passed[chosen] >= g_starvation_limit[chosen])
+			break;
+	}
+
+	if (chosen == RSU_TASK_PRIORITY_MAX)
+		goto on_error;
+
+	for (i = 0; i < RSU_TASK_PRIORITY_MAX; ++i) {
+		if (i == chosen || g_queue_is_empty(&queue->ready[i]))
+			queue->passed[i] = 0;
+		else
+			++queue->passed[i];
+	}
+
+	/* The client goes to the back of the line if it has more tasks
+	   in this class. */
+
+	client = g_queue_pop_head(&queue->ready[chosen]);
+	task = g_queue_pop_head(&client->tasks[chosen]);
+
+	if (!g_queue_is_empty(&client->tasks[chosen]))
+		g_queue_push_tail(&queue->ready[chosen], client);
+
+	if (--client->count == 0)
+		(void) g_hash_table_remove(queue->clients, client->name);
+
+on_error:
+
+	return task;
+}
+
+gboolean rsu_task_queue_is_empty(rsu_task_queue_t *queue)
+{
+	unsigned int i;
+
+	for (i = 0; i < RSU_TASK_PRIORITY_MAX; ++i)
+		if (!g_queue_is_empty(&queue->ready[i]))
+			break;
+
+	return i == RSU_TASK_PRIORITY_MAX;
+}
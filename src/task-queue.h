@@ -0,0 +1,40 @@
+/*
+ * renderer-service-upnp
+ *
+ * Copyright (C) 2012 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+
+#ifndef RSU_TASK_QUEUE_H__
+#define RSU_TASK_QUEUE_H__
+
+#include "task.h"
+#include "settings.h"
+
+typedef struct rsu_task_queue_t_ rsu_task_queue_t;
+
+void rsu_task_queue_new(const rsu_settings_t *settings,
+			rsu_task_queue_t **queue);
+void rsu_task_queue_delete(rsu_task_queue_t *queue);
+gboolean rsu_task_queue_push(rsu_task_queue_t *queue, rsu_task_t *task,
+			     rsu_task_t **superseded);
+rsu_task_t *rsu_task_queue_pop(rsu_task_queue_t *queue);
+gboolean rsu_task_queue_is_empty(rsu_task_queue_t *queue);
+
+#endif
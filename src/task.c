@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "task.h"
 #include "error.h"
 
@@ -50,6 +52,71 @@ rsu_task_t *rsu_task_get_servers_new(GDBusMethodInvocation *invocation)
 	return task;
 }
 
+rsu_task_t *rsu_task_get_servers_with_props_new(
+	GDBusMethodInvocation *invocation)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_GET_SERVERS_WITH_PROPS;
+	task->invocation = invocation;
+	task->result_format = "(@a{oa{sv}})";
+	task->synchronous = TRUE;
+
+	return task;
+}
+
+rsu_task_t *rsu_task_get_managed_objects_new(
+	GDBusMethodInvocation *invocation)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_GET_MANAGED_OBJECTS;
+	task->invocation = invocation;
+	task->result_format = "(@a{oa{sa{sv}}})";
+	task->synchronous = TRUE;
+
+	return task;
+}
+
+rsu_task_t *rsu_task_get_host_statistics_new(
+	GDBusMethodInvocation *invocation)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_GET_HOST_STATISTICS;
+	task->invocation = invocation;
+	task->result_format = "(@a{sv})";
+	task->synchronous = TRUE;
+
+	return task;
+}
+
+rsu_task_t *rsu_task_get_filter_new(GDBusMethodInvocation *invocation)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_GET_FILTER;
+	task->invocation = invocation;
+	task->result_format = "(@a{sv})";
+	task->synchronous = TRUE;
+
+	return task;
+}
+
+rsu_task_t *rsu_task_set_filter_new(GDBusMethodInvocation *invocation,
+				    GVariant *parameters)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_SET_FILTER;
+	task->invocation = invocation;
+	task->synchronous = TRUE;
+
+	g_variant_get(parameters, "(@a{sv})", &task->set_filter.filter);
+
+	return task;
+}
+
 rsu_task_t *rsu_task_raise_new(GDBusMethodInvocation *invocation)
 {
 	rsu_task_t *task = g_new0(rsu_task_t, 1);
@@ -82,6 +149,9 @@ static void prv_rsu_task_delete(rsu_task_t *task)
 		g_free(task->get_prop.interface_name);
 		g_free(task->get_prop.prop_name);
 		break;
+	case RSU_TASK_GET_SELECTED_PROPS:
+		g_strfreev(task->get_selected_props.prop_names);
+		break;
 	case RSU_TASK_OPEN_URI:
 		g_free(task->open_uri.uri);
 		break;
@@ -90,6 +160,21 @@ static void prv_rsu_task_delete(rsu_task_t *task)
 		g_free(task->host_uri.uri);
 		g_free(task->host_uri.client);
 		break;
+	case RSU_TASK_SET_FILTER:
+		g_variant_unref(task->set_filter.filter);
+		break;
+	case RSU_TASK_BATCH:
+		g_ptr_array_unref(task->batch.steps);
+		g_variant_builder_unref(task->batch.results);
+		g_free(task->batch.hosted_uri);
+		break;
+	case RSU_TASK_GROUP:
+		g_ptr_array_unref(task->group.steps);
+		g_variant_builder_unref(task->group.results);
+		rsu_group_play_delete(task->group.play);
+		if (task->group.timeout_id)
+			(void) g_source_remove(task->group.timeout_id);
+		break;
 	default:
 		break;
 	}
@@ -97,10 +182,39 @@ static void prv_rsu_task_delete(rsu_task_t *task)
 	g_free(task->path);
 	if (task->result)
 		g_variant_unref(task->result);
+	if (task->followers)
+		g_ptr_array_unref(task->followers);
+	if (task->cancellable)
+		g_object_unref(task->cancellable);
+	if (task->error)
+		g_error_free(task->error);
 
 	g_free(task);
 }
 
+static rsu_task_priority_t prv_task_priority(rsu_task_type_t type)
+{
+	rsu_task_priority_t priority;
+
+	switch (type) {
+	case RSU_TASK_GET_ALL_PROPS:
+	case RSU_TASK_GET_PROP:
+	case RSU_TASK_GET_SELECTED_PROPS:
+	case RSU_TASK_GET_CHANGES:
+		priority = RSU_TASK_PRIORITY_READ;
+		break;
+	case RSU_TASK_HOST_URI:
+	case RSU_TASK_REMOVE_URI:
+		priority = RSU_TASK_PRIORITY_BULK;
+		break;
+	default:
+		priority = RSU_TASK_PRIORITY_INTERACTIVE;
+		break;
+	}
+
+	return priority;
+}
+
 static rsu_task_t *prv_device_task_new(rsu_task_type_t type,
 				       GDBusMethodInvocation *invocation,
 				       const gchar *path,
@@ -109,6 +223,7 @@ static rsu_task_t *prv_device_task_new(rsu_task_type_t type,
 	rsu_task_t *task = g_new0(rsu_task_t, 1);
 
 	task->type = type;
+	task->priority = prv_task_priority(type);
 	task->invocation = invocation;
 	task->result_format = result_format;
 
@@ -148,6 +263,38 @@ rsu_task_t *rsu_task_get_props_new(GDBusMethodInvocation *invocation,
 	return task;
 }
 
+rsu_task_t *rsu_task_get_selected_props_new(
+	GDBusMethodInvocation *invocation, const gchar *path,
+	GVariant *parameters)
+{
+	rsu_task_t *task;
+	gchar **names;
+
+	task = prv_device_task_new(RSU_TASK_GET_SELECTED_PROPS, invocation,
+				   path, "(@a{sv})");
+
+	g_variant_get(parameters, "(^as)", &names);
+	task->get_selected_props.prop_names = names;
+
+	for (; *names; ++names)
+		g_strstrip(*names);
+
+	return task;
+}
+
+rsu_task_t *rsu_task_get_changes_new(GDBusMethodInvocation *invocation,
+				     const gchar *path, GVariant *parameters)
+{
+	rsu_task_t *task;
+
+	task = prv_device_task_new(RSU_TASK_GET_CHANGES, invocation, path,
+				   "@(tba{sa{sv}})");
+
+	g_variant_get(parameters, "(t)", &task->get_changes.version);
+
+	return task;
+}
+
 rsu_task_t *rsu_task_play_new(GDBusMethodInvocation *invocation,
 			      const gchar *path)
 {
@@ -255,22 +402,286 @@ rsu_task_t *rsu_task_remove_uri_new(GDBusMethodInvocation *invocation,
 	return task;
 }
 
+/* A batch task runs its steps, which are ordinary device tasks for the
+   same renderer, one after the other.  The steps have no invocation of
+   their own and are never queued; the batch task replies with the
+   result of each step that was run. */
+
+rsu_task_t *rsu_task_batch_new(GDBusMethodInvocation *invocation,
+			       const gchar *path)
+{
+	rsu_task_t *task;
+
+	task = prv_device_task_new(RSU_TASK_BATCH, invocation, path,
+				   "(@a(sav))");
+
+	task->batch.steps = g_ptr_array_new_with_free_func(
+		(GDestroyNotify) prv_rsu_task_delete);
+	task->batch.results = g_variant_builder_new(G_VARIANT_TYPE("a(sav)"));
+
+	return task;
+}
+
+void rsu_task_batch_add_step(rsu_task_t *task, rsu_task_t *step)
+{
+	step->invocation = NULL;
+	g_ptr_array_add(task->batch.steps, step);
+}
+
+/* The result of a step is the name and message of the error with which
+   the step failed, or an empty string, together with the step's return
+   values. */
+
+static GVariant *prv_step_result_new(rsu_task_t *step, const GError *error)
+{
+	gchar *name = NULL;
+	gchar *message;
+	GVariantBuilder values;
+	GVariant *retval;
+
+	g_variant_builder_init(&values, G_VARIANT_TYPE("av"));
+
+	if (error) {
+		name = g_dbus_error_encode_gerror(error);
+		message = g_strdup_printf("%s: %s", name, error->message);
+	} else {
+		message = g_strdup("");
+		if (step->result)
+			g_variant_builder_add(&values, "v", step->result);
+	}
+
+	retval = g_variant_new("(s@av)", message,
+			       g_variant_builder_end(&values));
+
+	g_free(message);
+	g_free(name);
+
+	return retval;
+}
+
+void rsu_task_batch_add_result(rsu_task_t *task, rsu_task_t *step,
+			       const GError *error)
+{
+	g_variant_builder_add_value(task->batch.results,
+				    prv_step_result_new(step, error));
+}
+
+/* A group task runs the same command on several renderers at once.
+   Each step is the command for one renderer and the task replies with
+   the result of each step, keyed by the path of its renderer. */
+
+rsu_task_t *rsu_task_group_new(GDBusMethodInvocation *invocation)
+{
+	rsu_task_t *task = g_new0(rsu_task_t, 1);
+
+	task->type = RSU_TASK_GROUP;
+	task->priority = prv_task_priority(RSU_TASK_GROUP);
+	task->invocation = invocation;
+	task->result_format = "(@a{s(sav)})";
+
+	task->group.steps = g_ptr_array_new_with_free_func(
+		(GDestroyNotify) prv_rsu_task_delete);
+	task->group.results = g_variant_builder_new(
+		G_VARIANT_TYPE("a{s(sav)}"));
+
+	return task;
+}
+
+/* A group play task starts playback on a group of renderers so that
+   they play in step.  The renderers are first moved to the position
+   given in parameters, unless it is negative.  The steps are added by
+   the caller. */
+
+rsu_task_t *rsu_task_group_play_new(GDBusMethodInvocation *invocation,
+				    GVariant *parameters)
+{
+	rsu_task_t *task = rsu_task_group_new(invocation);
+
+	task->result_format = "@(a{s(sav)}x)";
+	task->group.synchronised = TRUE;
+
+	g_variant_get_child(parameters, 1, "x", &task->group.position);
+
+	return task;
+}
+
+/* Returns FALSE, and deletes step, if the group already has a step for
+   the same renderer. */
+
+gboolean rsu_task_group_add_step(rsu_task_t *task, rsu_task_t *step)
+{
+	gboolean retval = !rsu_task_has_path(task, step->path);
+
+	step->invocation = NULL;
+
+	if (retval)
+		g_ptr_array_add(task->group.steps, step);
+	else
+		prv_rsu_task_delete(step);
+
+	return retval;
+}
+
+void rsu_task_group_add_result(rsu_task_t *task, rsu_task_t *step,
+			       const GError *error)
+{
+	g_variant_builder_add(task->group.results, "{s@(sav)}", step->path,
+			      prv_step_result_new(step, error));
+}
+
+/* Returns TRUE if task acts on the renderer whose path is path. */
+
+gboolean rsu_task_has_path(const rsu_task_t *task, const gchar *path)
+{
+	rsu_task_t *step;
+	unsigned int i;
+	gboolean retval = FALSE;
+
+	if (task->type != RSU_TASK_GROUP) {
+		retval = task->path && path && !strcmp(task->path, path);
+		goto on_error;
+	}
+
+	for (i = 0; i < task->group.steps->len && !retval; ++i) {
+		step = g_ptr_array_index(task->group.steps, i);
+		retval = path && !strcmp(step->path, path);
+	}
+
+on_error:
+
+	return retval;
+}
+
+/* Returns TRUE if task, which is about to be queued directly after
+   prev for the same renderer, makes prev redundant, in which case task
+   is updated to include the effect of prev.  Stop is never superseded
+   by Play or Pause, as it also resets the play position. */
+
+gboolean rsu_task_supersedes(rsu_task_t *task, const rsu_task_t *prev)
+{
+	gboolean retval = FALSE;
+
+	switch (task->type) {
+	case RSU_TASK_SEEK:
+		if (prev->type == RSU_TASK_SEEK) {
+			task->seek.position += prev->seek.position;
+			retval = TRUE;
+		}
+		break;
+	case RSU_TASK_SET_POSITION:
+		retval = prev->type == RSU_TASK_SEEK ||
+			prev->type == RSU_TASK_SET_POSITION;
+		break;
+	case RSU_TASK_STOP:
+		retval = prev->type == RSU_TASK_STOP;
+		/* Fall through */
+	case RSU_TASK_PLAY:
+	case RSU_TASK_PAUSE:
+		retval = retval || prev->type == RSU_TASK_PLAY ||
+			prev->type == RSU_TASK_PAUSE ||
+			prev->type == RSU_TASK_PLAY_PAUSE;
+		break;
+	default:
+		break;
+	}
+
+	return retval;
+}
+
+gboolean rsu_task_is_read(const rsu_task_t *task)
+{
+	return task->type == RSU_TASK_GET_PROP ||
+		task->type == RSU_TASK_GET_ALL_PROPS ||
+		task->type == RSU_TASK_GET_SELECTED_PROPS ||
+		task->type == RSU_TASK_GET_CHANGES;
+}
+
+/* Identical read tasks share a single task.  Returns a key that
+   identifies the data read by task, or NULL if task is not a read. */
+
+gchar *rsu_task_read_key(const rsu_task_t *task)
+{
+	gchar *retval = NULL;
+	gchar *data;
+
+	/* The key includes the task type, so that reads of different
+	   types, which return results of different types, are never
+	   shared. */
+
+	switch (task->type) {
+	case RSU_TASK_GET_PROP:
+		data = g_strdup_printf("%s\n%s", task->get_prop.interface_name,
+				       task->get_prop.prop_name);
+		break;
+	case RSU_TASK_GET_ALL_PROPS:
+		data = g_strdup(task->get_props.interface_name);
+		break;
+	case RSU_TASK_GET_SELECTED_PROPS:
+		data = g_strjoinv("\n", task->get_selected_props.prop_names);
+		break;
+	case RSU_TASK_GET_CHANGES:
+		data = g_strdup_printf("%"G_GUINT64_FORMAT,
+				       task->get_changes.version);
+		break;
+	default:
+		goto on_error;
+	}
+
+	retval = g_strdup_printf("%s\n%d\n%s", task->path, task->type, data);
+	g_free(data);
+
+on_error:
+
+	return retval;
+}
+
+/* follower's invocation is completed along with task's and follower is
+   deleted. */
+
+void rsu_task_add_follower(rsu_task_t *task, rsu_task_t *follower)
+{
+	if (!task->followers)
+		task->followers = g_ptr_array_new();
+
+	g_ptr_array_add(task->followers, follower->invocation);
+	follower->invocation = NULL;
+	prv_rsu_task_delete(follower);
+}
+
+static void prv_rsu_task_return(rsu_task_t *task,
+				GDBusMethodInvocation *invocation,
+				const GError *error)
+{
+	if (error)
+		g_dbus_method_invocation_return_gerror(invocation, error);
+	else if (task->result_format && task->result)
+		g_dbus_method_invocation_return_value(
+			invocation, g_variant_new(task->result_format,
+						  task->result));
+	else
+		g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static void prv_rsu_task_return_all(rsu_task_t *task, const GError *error)
+{
+	unsigned int i;
+
+	if (task->invocation)
+		prv_rsu_task_return(task, task->invocation, error);
+
+	if (task->followers)
+		for (i = 0; i < task->followers->len; ++i)
+			prv_rsu_task_return(
+				task, g_ptr_array_index(task->followers, i),
+				error);
+}
+
 void rsu_task_complete_and_delete(rsu_task_t *task)
 {
 	if (!task)
 		goto finished;
 
-	if (task->invocation) {
-		if (task->result_format && task->result)
-			g_dbus_method_invocation_return_value(
-				task->invocation,
-				g_variant_new(task->result_format,
-					      task->result));
-		else
-			g_dbus_method_invocation_return_value(task->invocation,
-							      NULL);
-	}
-
+	prv_rsu_task_return_all(task, NULL);
 	prv_rsu_task_delete(task);
 
 finished:
@@ -283,9 +694,7 @@ void rsu_task_fail_and_delete(rsu_task_t *task, GError *error)
 	if (!task)
 		goto finished;
 
-	if (task->invocation)
-		g_dbus_method_invocation_return_gerror(task->invocation, error);
-
+	prv_rsu_task_return_all(task, error);
 	prv_rsu_task_delete(task);
 
 finished:
@@ -300,12 +709,10 @@ void rsu_task_delete(rsu_task_t *task)
 	if (!task)
 		goto finished;
 
-	if (task->invocation) {
-		error = g_error_new(RSU_ERROR, RSU_ERROR_DIED,
-				    "Unable to complete command.");
-		g_dbus_method_invocation_return_gerror(task->invocation, error);
-		g_error_free(error);
-	}
+	error = g_error_new(RSU_ERROR, RSU_ERROR_DIED,
+			    "Unable to complete command.");
+	prv_rsu_task_return_all(task, error);
+	g_error_free(error);
 
 	prv_rsu_task_delete(task);
 
@@ -26,13 +26,22 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#include "group-play.h"
+
 enum rsu_task_type_t_{
 	RSU_TASK_GET_VERSION,
 	RSU_TASK_GET_SERVERS,
+	RSU_TASK_GET_SERVERS_WITH_PROPS,
+	RSU_TASK_GET_MANAGED_OBJECTS,
+	RSU_TASK_GET_HOST_STATISTICS,
+	RSU_TASK_GET_FILTER,
+	RSU_TASK_SET_FILTER,
 	RSU_TASK_RAISE,
 	RSU_TASK_QUIT,
 	RSU_TASK_GET_ALL_PROPS,
 	RSU_TASK_GET_PROP,
+	RSU_TASK_GET_SELECTED_PROPS,
+	RSU_TASK_GET_CHANGES,
 	RSU_TASK_PAUSE,
 	RSU_TASK_PLAY,
 	RSU_TASK_PLAY_PAUSE,
@@ -43,10 +52,20 @@ enum rsu_task_type_t_{
 	RSU_TASK_SEEK,
 	RSU_TASK_SET_POSITION,
 	RSU_TASK_HOST_URI,
-	RSU_TASK_REMOVE_URI
+	RSU_TASK_REMOVE_URI,
+	RSU_TASK_BATCH,
+	RSU_TASK_GROUP
 };
 typedef enum rsu_task_type_t_ rsu_task_type_t;
 
+enum rsu_task_priority_t_ {
+	RSU_TASK_PRIORITY_INTERACTIVE,
+	RSU_TASK_PRIORITY_READ,
+	RSU_TASK_PRIORITY_BULK,
+	RSU_TASK_PRIORITY_MAX
+};
+typedef enum rsu_task_priority_t_ rsu_task_priority_t;
+
 typedef void (*rsu_cancel_task_t)(void *handle);
 
 typedef struct rsu_task_get_props_t_ rsu_task_get_props_t;
@@ -60,6 +79,16 @@ struct rsu_task_get_prop_t_ {
 	gchar *interface_name;
 };
 
+typedef struct rsu_task_get_selected_props_t_ rsu_task_get_selected_props_t;
+struct rsu_task_get_selected_props_t_ {
+	gchar **prop_names;
+};
+
+typedef struct rsu_task_get_changes_t_ rsu_task_get_changes_t;
+struct rsu_task_get_changes_t_ {
+	guint64 version;
+};
+
 typedef struct rsu_task_open_uri_t_ rsu_task_open_uri_t;
 struct rsu_task_open_uri_t_ {
 	gchar *uri;
@@ -76,31 +105,84 @@ struct rsu_task_host_uri_t_ {
 	gchar *client;
 };
 
+typedef struct rsu_task_set_filter_t_ rsu_task_set_filter_t;
+struct rsu_task_set_filter_t_ {
+	GVariant *filter;
+};
+
 typedef struct rsu_task_t_ rsu_task_t;
+
+typedef struct rsu_task_batch_t_ rsu_task_batch_t;
+struct rsu_task_batch_t_ {
+	GPtrArray *steps;
+	guint next;
+	GVariantBuilder *results;
+	gchar *hosted_uri;
+	gpointer user_data;
+};
+
+typedef struct rsu_task_group_t_ rsu_task_group_t;
+struct rsu_task_group_t_ {
+	GPtrArray *steps;
+	guint pending;
+	GVariantBuilder *results;
+	gpointer user_data;
+	gboolean synchronised;
+	gint64 position;
+	rsu_group_play_t *play;
+	guint round;
+	guint timeout_id;
+};
+
 struct rsu_task_t_ {
 	rsu_task_type_t type;
+	rsu_task_priority_t priority;
 	gchar *path;
 	const gchar *result_format;
 	GVariant *result;
 	GDBusMethodInvocation *invocation;
+	GPtrArray *followers;
 	gboolean synchronous;
+	GCancellable *cancellable;
+	gint64 start_time;
+	GError *error;
+	gboolean done;
 	union {
 		rsu_task_get_props_t get_props;
 		rsu_task_get_prop_t get_prop;
+		rsu_task_get_selected_props_t get_selected_props;
+		rsu_task_get_changes_t get_changes;
 		rsu_task_open_uri_t open_uri;
 		rsu_task_host_uri_t host_uri;
 		rsu_task_seek_t seek;
+		rsu_task_set_filter_t set_filter;
+		rsu_task_batch_t batch;
+		rsu_task_group_t group;
 	};
 };
 
 rsu_task_t *rsu_task_get_version_new(GDBusMethodInvocation *invocation);
 rsu_task_t *rsu_task_get_servers_new(GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_get_servers_with_props_new(
+	GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_get_managed_objects_new(
+	GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_get_host_statistics_new(
+	GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_get_filter_new(GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_set_filter_new(GDBusMethodInvocation *invocation,
+				    GVariant *parameters);
 rsu_task_t *rsu_task_raise_new(GDBusMethodInvocation *invocation);
 rsu_task_t *rsu_task_quit_new(GDBusMethodInvocation *invocation);
 rsu_task_t *rsu_task_get_prop_new(GDBusMethodInvocation *invocation,
 				  const gchar *path, GVariant *parameters);
 rsu_task_t *rsu_task_get_props_new(GDBusMethodInvocation *invocation,
 				   const gchar *path, GVariant *parameters);
+rsu_task_t *rsu_task_get_selected_props_new(
+	GDBusMethodInvocation *invocation, const gchar *path,
+	GVariant *parameters);
+rsu_task_t *rsu_task_get_changes_new(GDBusMethodInvocation *invocation,
+				     const gchar *path, GVariant *parameters);
 rsu_task_t *rsu_task_play_new(GDBusMethodInvocation *invocation,
 			      const gchar *path);
 rsu_task_t *rsu_task_pause_new(GDBusMethodInvocation *invocation,
@@ -123,6 +205,22 @@ rsu_task_t *rsu_task_host_uri_new(GDBusMethodInvocation *invocation,
 				  const gchar *path, GVariant *parameters);
 rsu_task_t *rsu_task_remove_uri_new(GDBusMethodInvocation *invocation,
 				    const gchar *path, GVariant *parameters);
+rsu_task_t *rsu_task_batch_new(GDBusMethodInvocation *invocation,
+			       const gchar *path);
+void rsu_task_batch_add_step(rsu_task_t *task, rsu_task_t *step);
+void rsu_task_batch_add_result(rsu_task_t *task, rsu_task_t *step,
+			       const GError *error);
+rsu_task_t *rsu_task_group_new(GDBusMethodInvocation *invocation);
+rsu_task_t *rsu_task_group_play_new(GDBusMethodInvocation *invocation,
+				    GVariant *parameters);
+gboolean rsu_task_group_add_step(rsu_task_t *task, rsu_task_t *step);
+void rsu_task_group_add_result(rsu_task_t *task, rsu_task_t *step,
+			       const GError *error);
+gboolean rsu_task_has_path(const rsu_task_t *task, const gchar *path);
+gboolean rsu_task_supersedes(rsu_task_t *task, const rsu_task_t *prev);
+gchar *rsu_task_read_key(const rsu_task_t *task);
+gboolean rsu_task_is_read(const rsu_task_t *task);
+void rsu_task_add_follower(rsu_task_t *task, rsu_task_t *follower);
 void rsu_task_complete_and_delete(rsu_task_t *task);
 void rsu_task_fail_and_delete(rsu_task_t *task, GError *error);
 void rsu_task_delete(rsu_task_t *task);
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <string.h>
+#include <glib/gstdio.h>
 
 #include <libgupnp/gupnp-context-manager.h>
 #include <libgupnp/gupnp-error.h>
@@ -33,52 +34,258 @@
 #include "async.h"
 #include "device.h"
 #include "host-service.h"
+#include "discovery.h"
+#include "filter.h"
+#include "liveness.h"
+
+#define RSU_UPNP_CACHE_FILE "renderers"
+#define RSU_UPNP_CACHE_SAVE_DELAY 2
 
 struct rsu_upnp_t_ {
 	GDBusConnection *connection;
+	rsu_settings_t *settings;
 	rsu_interface_info_t *interface_info;
 	rsu_upnp_callback_t found_server;
 	rsu_upnp_callback_t lost_server;
 	GUPnPContextManager *context_manager;
 	void *user_data;
 	GHashTable *server_udn_map;
-	guint counter;
 	rsu_host_service_t *host_service;
+	rsu_discovery_t *discovery;
+	rsu_filter_t *filter;
+	rsu_liveness_t *liveness;
+	GPtrArray *control_points;
+	guint cache_save_id;
 };
 
-static void prv_server_available_cb(GUPnPControlPoint *cp,
-				    GUPnPDeviceProxy *proxy,
-				    gpointer user_data)
+typedef struct rsu_upnp_expiry_t_ rsu_upnp_expiry_t;
+struct rsu_upnp_expiry_t_ {
+	rsu_upnp_t *upnp;
+	gchar *udn;
+};
+
+static gchar *prv_cache_path(void)
+{
+	return g_build_filename(g_get_user_cache_dir(), PACKAGE,
+				RSU_UPNP_CACHE_FILE, NULL);
+}
+
+static void prv_cache_save(rsu_upnp_t *upnp)
+{
+	GKeyFile *keyfile;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	gchar *path;
+	gchar *dir;
+	gchar *data;
+	gsize length;
+
+	keyfile = g_key_file_new();
+	g_hash_table_iter_init(&iter, upnp->server_udn_map);
+
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		rsu_device_save(value, key, keyfile);
+
+	data = g_key_file_to_data(keyfile, &length, NULL);
+	path = prv_cache_path();
+	dir = g_path_get_dirname(path);
+
+	if (g_mkdir_with_parents(dir, 0700) == 0)
+		(void) g_file_set_contents(path, data, length, NULL);
+
+	g_free(dir);
+	g_free(path);
+	g_free(data);
+	g_key_file_free(keyfile);
+}
+
+static gboolean prv_cache_save_cb(gpointer user_data)
 {
 	rsu_upnp_t *upnp = user_data;
-	const char *udn;
+
+	upnp->cache_save_id = 0;
+	prv_cache_save(upnp);
+
+	return FALSE;
+}
+
+static void prv_cache_schedule_save(rsu_upnp_t *upnp)
+{
+	/* Renderers tend to be found in bursts, so we wait a little
+	   before writing the cache to avoid rewriting it for each one. */
+
+	if (upnp->settings->cache_expiry && !upnp->cache_save_id)
+		upnp->cache_save_id = g_timeout_add_seconds(
+			RSU_UPNP_CACHE_SAVE_DELAY, prv_cache_save_cb, upnp);
+}
+
+static void prv_lost_device(rsu_upnp_t *upnp, rsu_device_t *device,
+			    const gchar *udn)
+{
+	upnp->lost_server(device->path, upnp->user_data);
+	g_hash_table_remove(upnp->server_udn_map, udn);
+}
+
+static void prv_expiry_free(gpointer user_data)
+{
+	rsu_upnp_expiry_t *expiry = user_data;
+
+	g_free(expiry->udn);
+	g_free(expiry);
+}
+
+static gboolean prv_device_expired_cb(gpointer user_data)
+{
+	rsu_upnp_expiry_t *expiry = user_data;
 	rsu_device_t *device;
-	const gchar *ip_address;
-	rsu_context_t *context;
+
+	device = g_hash_table_lookup(expiry->upnp->server_udn_map,
+				     expiry->udn);
+
+	if (device) {
+		g_debug("Renderer %s has not been found on the network,"
+			" removing it", expiry->udn);
+
+		device->expiry_id = 0;
+		prv_lost_device(expiry->upnp, device, expiry->udn);
+	}
+
+	return FALSE;
+}
+
+static void prv_device_set_expiry(rsu_upnp_t *upnp, rsu_device_t *device,
+				  const gchar *udn, guint seconds)
+{
+	rsu_upnp_expiry_t *expiry;
+
+	expiry = g_new(rsu_upnp_expiry_t, 1);
+	expiry->upnp = upnp;
+	expiry->udn = g_strdup(udn);
+
+	device->expiry_id = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT,
+						       seconds,
+						       prv_device_expired_cb,
+						       expiry,
+						       prv_expiry_free);
+}
+
+static void prv_device_cancel_expiry(rsu_device_t *device)
+{
+	if (device->expiry_id) {
+		(void) g_source_remove(device->expiry_id);
+		device->expiry_id = 0;
+	}
+}
+
+static void prv_cache_load(rsu_upnp_t *upnp)
+{
+	GKeyFile *keyfile;
+	gchar *path;
+	gchar **udns = NULL;
 	unsigned int i;
+	rsu_device_t *device;
 
-	udn = gupnp_device_info_get_udn((GUPnPDeviceInfo *) proxy);
-	if (!udn)
+	keyfile = g_key_file_new();
+	path = prv_cache_path();
+
+	if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL))
 		goto on_error;
 
-	ip_address = gupnp_context_get_host_ip(
-		gupnp_control_point_get_context(cp));
+	udns = g_key_file_get_groups(keyfile, NULL);
+
+	for (i = 0; udns[i]; ++i) {
+		if (!rsu_filter_allow_udn(upnp->filter, udns[i]))
+			continue;
+
+		if (!rsu_device_new_from_cache(upnp->connection,
+					       upnp->settings, keyfile,
+					       udns[i], upnp->interface_info,
+					       upnp->user_data, &device))
+			continue;
+
+		g_hash_table_insert(upnp->server_udn_map, g_strdup(udns[i]),
+				    device);
+		rsu_discovery_add_known(upnp->discovery, udns[i]);
+
+		/* The renderer is removed if it is not found on the network
+		   before the cache entry expires. */
+
+		prv_device_set_expiry(upnp, device, udns[i],
+				      upnp->settings->cache_expiry);
+	}
+
+on_error:
+
+	g_strfreev(udns);
+	g_free(path);
+	g_key_file_free(keyfile);
+}
+
+static rsu_device_t *prv_get_device(rsu_upnp_t *upnp, rsu_task_t *task,
+				    gboolean need_context,
+				    rsu_upnp_task_complete_t cb,
+				    void *user_data)
+{
+	rsu_device_t *device;
+	rsu_async_cb_data_t *cb_data;
+	GError *error = NULL;
+
+	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+
+	if (!device) {
+		error = g_error_new(RSU_ERROR, RSU_ERROR_OBJECT_NOT_FOUND,
+				    "Cannot locate a device for the specified "
+				    "object");
+	} else if (need_context && device->contexts->len == 0) {
+		error = g_error_new(RSU_ERROR, RSU_ERROR_OBJECT_NOT_FOUND,
+				    "Renderer has not yet been found on the "
+				    "network");
+		device = NULL;
+	}
+
+	if (error) {
+		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
+						NULL);
+		cb_data->error = error;
+		(void) g_idle_add(rsu_async_complete_task, cb_data);
+	} else {
+		rsu_device_touch(device, upnp->settings->subscription_timeout);
+	}
+
+	return device;
+}
+
+static void prv_add_device_context(rsu_upnp_t *upnp,
+				   GUPnPContext *gupnp_context,
+				   GUPnPDeviceProxy *proxy, const gchar *udn)
+{
+	rsu_device_t *device;
+	const gchar *ip_address;
+	rsu_context_t *context;
+	unsigned int i;
+
+	ip_address = gupnp_context_get_host_ip(gupnp_context);
 
 	device = g_hash_table_lookup(upnp->server_udn_map, udn);
 
 	if (!device) {
-		if (rsu_device_new(upnp->connection, proxy,
+		if (rsu_device_new(upnp->connection, upnp->settings, proxy,
 				   ip_address,
-				   upnp->counter,
+				   udn,
 				   upnp->interface_info,
 				   upnp->user_data,
 				   &device)) {
-			++upnp->counter;
 			g_hash_table_insert(upnp->server_udn_map, g_strdup(udn),
 					    device);
 			upnp->found_server(device->path, upnp->user_data);
 		}
 	} else {
+		/* The renderer may have been loaded from the cache or be
+		   returning within its grace period. */
+
+		prv_device_cancel_expiry(device);
+
 		for (i = 0; i < device->contexts->len; ++i) {
 			context = g_ptr_array_index(device->contexts, i);
 
@@ -91,28 +298,47 @@ static void prv_server_available_cb(GUPnPControlPoint *cp,
 						      proxy);
 	}
 
+	rsu_liveness_add(upnp->liveness, gupnp_context, proxy, udn);
+}
+
+static void prv_server_available_cb(GUPnPControlPoint *cp,
+				    GUPnPDeviceProxy *proxy,
+				    gpointer user_data)
+{
+	rsu_upnp_t *upnp = user_data;
+	const char *udn;
+	GUPnPContext *context;
+
+	udn = gupnp_device_info_get_udn((GUPnPDeviceInfo *) proxy);
+	if (!udn)
+		goto on_error;
+
+	context = gupnp_control_point_get_context(cp);
+
+	if (rsu_filter_allow_context(upnp->filter, context) &&
+	    rsu_filter_allow_device(upnp->filter, (GUPnPDeviceInfo *) proxy))
+		prv_add_device_context(upnp, context, proxy, udn);
+	else
+		g_debug("Renderer %s excluded by filter", udn);
+
+	rsu_discovery_device_found(upnp->discovery, cp, udn);
+	prv_cache_schedule_save(upnp);
+
 on_error:
 
 	return;
 }
 
-static void prv_server_unavailable_cb(GUPnPControlPoint *cp,
-				      GUPnPDeviceProxy *proxy,
-				      gpointer user_data)
+static void prv_remove_device_context(rsu_upnp_t *upnp,
+				      GUPnPContext *gupnp_context,
+				      const gchar *udn)
 {
-	rsu_upnp_t *upnp = user_data;
-	const char *udn;
 	rsu_device_t *device;
 	const gchar *ip_address;
 	unsigned int i;
 	rsu_context_t *context;
 
-	udn = gupnp_device_info_get_udn((GUPnPDeviceInfo *) proxy);
-	if (!udn)
-		goto on_error;
-
-	ip_address = gupnp_context_get_host_ip(
-		gupnp_control_point_get_context(cp));
+	ip_address = gupnp_context_get_host_ip(gupnp_context);
 
 	device = g_hash_table_lookup(upnp->server_udn_map, udn);
 	if (!device)
@@ -126,15 +352,27 @@ static void prv_server_unavailable_cb(GUPnPControlPoint *cp,
 	}
 
 	if (i < device->contexts->len) {
-		(void) g_ptr_array_remove_index(device->contexts, i);
-
-		if (device->contexts->len == 0) {
-			if (device->current_task)
-				rsu_async_task_lost_object(
-					device->current_task);
-
-			upnp->lost_server(device->path, upnp->user_data);
-			g_hash_table_remove(upnp->server_udn_map, udn);
+		rsu_device_remove_context(device, i);
+
+		if (device->contexts->len > 0)
+			goto on_error;
+
+		/* SSDP announcements from renderers on flaky networks can
+		   come and go.  Rather than removing the renderer straight
+		   away, which would give it a new object path when it
+		   returns, we keep it around for a grace period.  Any
+		   command in progress was failed when the context was
+		   removed. */
+
+		if (upnp->settings->grace_period) {
+			g_debug("Renderer %s is unavailable, keeping it for"
+				" %u seconds", udn,
+				upnp->settings->grace_period);
+
+			prv_device_set_expiry(upnp, device, udn,
+					      upnp->settings->grace_period);
+		} else {
+			prv_lost_device(upnp, device, udn);
 		}
 	}
 
@@ -143,6 +381,41 @@ on_error:
 	return;
 }
 
+static void prv_server_unavailable_cb(GUPnPControlPoint *cp,
+				      GUPnPDeviceProxy *proxy,
+				      gpointer user_data)
+{
+	rsu_upnp_t *upnp = user_data;
+	const char *udn;
+	GUPnPContext *context;
+
+	udn = gupnp_device_info_get_udn((GUPnPDeviceInfo *) proxy);
+	if (!udn)
+		goto on_error;
+
+	context = gupnp_control_point_get_context(cp);
+
+	rsu_liveness_remove(upnp->liveness, context, udn);
+	prv_remove_device_context(upnp, context, udn);
+
+on_error:
+
+	return;
+}
+
+static void prv_liveness_expired_cb(GUPnPContext *context, const gchar *udn,
+				    void *user_data)
+{
+	prv_remove_device_context(user_data, context, udn);
+}
+
+static void prv_liveness_revived_cb(GUPnPContext *context,
+				    GUPnPDeviceProxy *proxy,
+				    const gchar *udn, void *user_data)
+{
+	prv_add_device_context(user_data, context, proxy, udn);
+}
+
 static void prv_on_context_available(GUPnPContextManager *context_manager,
 				     GUPnPContext *context,
 				     gpointer user_data)
@@ -160,12 +433,44 @@ static void prv_on_context_available(GUPnPContextManager *context_manager,
 	g_signal_connect(cp, "device-proxy-unavailable",
 			 G_CALLBACK(prv_server_unavailable_cb), upnp);
 
-	gssdp_resource_browser_set_active(GSSDP_RESOURCE_BROWSER(cp), TRUE);
+	rsu_discovery_watch(upnp->discovery, cp);
+	rsu_liveness_watch(upnp->liveness, context);
+
+	/* We do not search for renderers on network interfaces that are
+	   excluded by the filter.  The control point is kept in case the
+	   filter is changed. */
+
+	gssdp_resource_browser_set_active(
+		GSSDP_RESOURCE_BROWSER(cp),
+		rsu_filter_allow_context(upnp->filter, context));
 	gupnp_context_manager_manage_control_point(upnp->context_manager, cp);
-	g_object_unref(cp);
+	g_ptr_array_add(upnp->control_points, cp);
+}
+
+static void prv_on_context_unavailable(GUPnPContextManager *context_manager,
+				       GUPnPContext *context,
+				       gpointer user_data)
+{
+	rsu_upnp_t *upnp = user_data;
+	GUPnPControlPoint *cp;
+	unsigned int i = 0;
+
+	rsu_discovery_context_unavailable(upnp->discovery, context);
+	rsu_liveness_context_unavailable(upnp->liveness, context);
+
+	while (i < upnp->control_points->len) {
+		cp = g_ptr_array_index(upnp->control_points, i);
+
+		if (gupnp_control_point_get_context(cp) == context)
+			(void) g_ptr_array_remove_index_fast(
+				upnp->control_points, i);
+		else
+			++i;
+	}
 }
 
 rsu_upnp_t *rsu_upnp_new(GDBusConnection *connection,
+			 rsu_settings_t *settings,
 			 rsu_interface_info_t *interface_info,
 			 rsu_upnp_callback_t found_server,
 			 rsu_upnp_callback_t lost_server,
@@ -174,6 +479,7 @@ rsu_upnp_t *rsu_upnp_new(GDBusConnection *connection,
 	rsu_upnp_t *upnp = g_new0(rsu_upnp_t, 1);
 
 	upnp->connection = connection;
+	upnp->settings = settings;
 	upnp->interface_info = interface_info;
 	upnp->user_data = user_data;
 	upnp->found_server = found_server;
@@ -182,13 +488,26 @@ rsu_upnp_t *rsu_upnp_new(GDBusConnection *connection,
 	upnp->server_udn_map = g_hash_table_new_full(g_str_hash, g_str_equal,
 						     g_free,
 						     rsu_device_delete);
+	rsu_filter_new(settings, &upnp->filter);
+	rsu_discovery_new(settings, upnp->filter, &upnp->discovery);
+	rsu_liveness_new(settings, prv_liveness_expired_cb,
+			 prv_liveness_revived_cb, upnp, &upnp->liveness);
+	upnp->control_points = g_ptr_array_new_with_free_func(g_object_unref);
+
+	if (settings->cache_expiry)
+		prv_cache_load(upnp);
+
 	upnp->context_manager = gupnp_context_manager_create(0);
 
 	g_signal_connect(upnp->context_manager, "context-available",
 			 G_CALLBACK(prv_on_context_available),
 			 upnp);
 
-	rsu_host_service_new(&upnp->host_service);
+	g_signal_connect(upnp->context_manager, "context-unavailable",
+			 G_CALLBACK(prv_on_context_unavailable),
+			 upnp);
+
+	rsu_host_service_new(settings, &upnp->host_service);
 
 	return upnp;
 }
@@ -196,8 +515,17 @@ rsu_upnp_t *rsu_upnp_new(GDBusConnection *connection,
 void rsu_upnp_delete(rsu_upnp_t *upnp)
 {
 	if (upnp) {
+		if (upnp->cache_save_id)
+			(void) g_source_remove(upnp->cache_save_id);
+		if (upnp->settings->cache_expiry)
+			prv_cache_save(upnp);
+
 		rsu_host_service_delete(upnp->host_service);
+		rsu_liveness_delete(upnp->liveness);
+		g_ptr_array_unref(upnp->control_points);
 		g_object_unref(upnp->context_manager);
+		rsu_discovery_delete(upnp->discovery);
+		rsu_filter_delete(upnp->filter);
 		g_hash_table_unref(upnp->server_udn_map);
 
 		g_free(upnp->interface_info);
@@ -223,28 +551,188 @@ GVariant *rsu_upnp_get_server_ids(rsu_upnp_t *upnp)
 	return g_variant_ref_sink(g_variant_builder_end(&vb));
 }
 
+GVariant *rsu_upnp_get_servers_with_props(rsu_upnp_t *upnp)
+{
+	GVariantBuilder vb;
+	GHashTableIter iter;
+	gpointer value;
+	rsu_device_t *device;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{oa{sv}}"));
+	g_hash_table_iter_init(&iter, upnp->server_udn_map);
+
+	/* The client is interested in all of the renderers, so we
+	   subscribe to the events of those that have not been used
+	   recently, to bring their evented properties up to date. */
+
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		device = value;
+		rsu_device_touch(device, upnp->settings->subscription_timeout);
+		g_variant_builder_add(&vb, "{o@a{sv}}", device->path,
+				      rsu_device_get_cached_props(device));
+	}
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+GVariant *rsu_upnp_get_managed_objects(rsu_upnp_t *upnp)
+{
+	GVariantBuilder vb;
+	GHashTableIter iter;
+	gpointer value;
+	rsu_device_t *device;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+	g_hash_table_iter_init(&iter, upnp->server_udn_map);
+
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		device = value;
+		rsu_device_touch(device, upnp->settings->subscription_timeout);
+		g_variant_builder_add(&vb, "{o@a{sa{sv}}}", device->path,
+				      rsu_device_get_interfaces(device));
+	}
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+/* Returns the interfaces of the server object whose path is path, in
+   the form used by InterfacesAdded, or NULL if there is no such
+   object. */
+
+GVariant *rsu_upnp_get_server_interfaces(rsu_upnp_t *upnp, const gchar *path)
+{
+	rsu_device_t *device;
+	GVariant *retval = NULL;
+
+	device = rsu_device_from_path(path, upnp->server_udn_map);
+
+	if (device)
+		retval = g_variant_ref_sink(rsu_device_get_interfaces(device));
+
+	return retval;
+}
+
+GVariant *rsu_upnp_get_host_statistics(rsu_upnp_t *upnp)
+{
+	return rsu_host_service_get_statistics(upnp->host_service);
+}
+
+/* Returns the SOAP round trip time, in microseconds, of the renderer
+   whose server object is path, or 0 if it is not known. */
+
+gint64 rsu_upnp_get_rtt(rsu_upnp_t *upnp, const gchar *path)
+{
+	rsu_device_t *device;
+	gint64 rtt = 0;
+
+	device = rsu_device_from_path(path, upnp->server_udn_map);
+
+	if (device && device->contexts->len)
+		rtt = rsu_device_get_context(device)->rtt;
+
+	return rtt;
+}
+
+GVariant *rsu_upnp_get_filter(rsu_upnp_t *upnp)
+{
+	return rsu_filter_get(upnp->filter);
+}
+
+static void prv_apply_filter(rsu_upnp_t *upnp)
+{
+	GUPnPControlPoint *cp;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	rsu_device_t *device;
+	rsu_context_t *context;
+	GUPnPDeviceInfo *info;
+	GUPnPContext *gupnp_context;
+	GPtrArray *lost;
+	const GList *proxies;
+	gboolean allowed;
+	unsigned int had_contexts;
+	unsigned int i;
+
+	/* The browsers and control points will not report the renderers
+	   they already know about again, so the renderers that may have
+	   been excluded by the old filter are reconsidered here. */
+
+	for (i = 0; i < upnp->control_points->len; ++i) {
+		cp = g_ptr_array_index(upnp->control_points, i);
+		allowed = rsu_filter_allow_context(
+			upnp->filter, gupnp_control_point_get_context(cp));
+		gssdp_resource_browser_set_active(GSSDP_RESOURCE_BROWSER(cp),
+						  allowed);
+
+		proxies = allowed ?
+			gupnp_control_point_list_device_proxies(cp) : NULL;
+		for (; proxies; proxies = proxies->next)
+			prv_server_available_cb(cp, proxies->data, upnp);
+	}
+
+	rsu_discovery_filter_changed(upnp->discovery);
+
+	lost = g_ptr_array_new_with_free_func(g_free);
+	g_hash_table_iter_init(&iter, upnp->server_udn_map);
+
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		device = value;
+		had_contexts = device->contexts->len;
+
+		for (i = device->contexts->len; i > 0; --i) {
+			context = g_ptr_array_index(device->contexts, i - 1);
+			info = (GUPnPDeviceInfo *) context->device_proxy;
+
+			gupnp_context = gupnp_device_info_get_context(info);
+
+			if (!rsu_filter_allow_context(upnp->filter,
+						      gupnp_context) ||
+			    !rsu_filter_allow_device(upnp->filter, info)) {
+				rsu_liveness_remove(upnp->liveness,
+						    gupnp_context, key);
+				rsu_device_remove_context(device, i - 1);
+			}
+		}
+
+		if (device->contexts->len == 0 &&
+		    (had_contexts || !rsu_filter_allow_udn(upnp->filter, key)))
+			g_ptr_array_add(lost, g_strdup(key));
+	}
+
+	for (i = 0; i < lost->len; ++i) {
+		key = g_ptr_array_index(lost, i);
+		device = g_hash_table_lookup(upnp->server_udn_map, key);
+		prv_lost_device(upnp, device, key);
+	}
+
+	g_ptr_array_unref(lost);
+}
+
+gboolean rsu_upnp_set_filter(rsu_upnp_t *upnp, GVariant *filter,
+			     GError **error)
+{
+	gboolean retval;
+
+	retval = rsu_filter_set(upnp->filter, filter, error);
+
+	if (retval)
+		prv_apply_filter(upnp);
+
+	return retval;
+}
+
 void rsu_upnp_get_prop(rsu_upnp_t *upnp, rsu_task_t *task,
 		       GCancellable *cancellable,
 		       rsu_upnp_task_complete_t cb,
 		       void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, FALSE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_get_prop(device, task, cancellable, cb, user_data);
-	}
 }
 
 void rsu_upnp_get_all_props(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -253,23 +741,40 @@ void rsu_upnp_get_all_props(rsu_upnp_t *upnp, rsu_task_t *task,
 			    void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, FALSE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_get_all_props(device, task, cancellable, cb,
 					 user_data);
-	}
+}
+
+void rsu_upnp_get_selected_props(rsu_upnp_t *upnp, rsu_task_t *task,
+				 GCancellable *cancellable,
+				 rsu_upnp_task_complete_t cb,
+				 void *user_data)
+{
+	rsu_device_t *device;
+
+	device = prv_get_device(upnp, task, FALSE, cb, user_data);
+
+	if (device)
+		rsu_device_get_selected_props(device, task, cancellable, cb,
+					      user_data);
+}
+
+void rsu_upnp_get_changes(rsu_upnp_t *upnp, rsu_task_t *task,
+			  GCancellable *cancellable,
+			  rsu_upnp_task_complete_t cb,
+			  void *user_data)
+{
+	rsu_device_t *device;
+
+	device = prv_get_device(upnp, task, FALSE, cb, user_data);
+
+	if (device)
+		rsu_device_get_changes(device, task, cancellable, cb,
+				       user_data);
 }
 
 void rsu_upnp_play(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -278,23 +783,12 @@ void rsu_upnp_play(rsu_upnp_t *upnp, rsu_task_t *task,
 		   void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_play(device, task, cancellable, cb,
 				user_data);
-	}
 }
 
 void rsu_upnp_pause(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -303,23 +797,12 @@ void rsu_upnp_pause(rsu_upnp_t *upnp, rsu_task_t *task,
 		    void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_pause(device, task, cancellable, cb,
 				 user_data);
-	}
 }
 
 void rsu_upnp_play_pause(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -328,23 +811,12 @@ void rsu_upnp_play_pause(rsu_upnp_t *upnp, rsu_task_t *task,
 			 void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_play_pause(device, task, cancellable, cb,
 				      user_data);
-	}
 }
 
 void rsu_upnp_stop(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -353,23 +825,12 @@ void rsu_upnp_stop(rsu_upnp_t *upnp, rsu_task_t *task,
 		   void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_stop(device, task, cancellable, cb,
 				user_data);
-	}
 }
 
 void rsu_upnp_next(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -378,23 +839,12 @@ void rsu_upnp_next(rsu_upnp_t *upnp, rsu_task_t *task,
 		   void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_next(device, task, cancellable, cb,
 				user_data);
-	}
 }
 
 void rsu_upnp_previous(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -403,23 +853,12 @@ void rsu_upnp_previous(rsu_upnp_t *upnp, rsu_task_t *task,
 		       void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_previous(device, task, cancellable, cb,
 				    user_data);
-	}
 }
 
 void rsu_upnp_open_uri(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -428,23 +867,12 @@ void rsu_upnp_open_uri(rsu_upnp_t *upnp, rsu_task_t *task,
 		       void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_open_uri(device, task, cancellable, cb,
 				    user_data);
-	}
 }
 
 void rsu_upnp_seek(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -453,22 +881,11 @@ void rsu_upnp_seek(rsu_upnp_t *upnp, rsu_task_t *task,
 		   void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_seek(device, task, cancellable, cb, user_data);
-	}
 }
 
 void rsu_upnp_set_position(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -477,23 +894,12 @@ void rsu_upnp_set_position(rsu_upnp_t *upnp, rsu_task_t *task,
 			   void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_set_position(device, task, cancellable, cb,
 					user_data);
-	}
 }
 
 void rsu_upnp_host_uri(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -502,23 +908,12 @@ void rsu_upnp_host_uri(rsu_upnp_t *upnp, rsu_task_t *task,
 		       void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_host_uri(device, task, upnp->host_service,
 				    cancellable, cb, user_data);
-	}
 }
 
 void rsu_upnp_remove_uri(rsu_upnp_t *upnp, rsu_task_t *task,
@@ -527,23 +922,12 @@ void rsu_upnp_remove_uri(rsu_upnp_t *upnp, rsu_task_t *task,
 			 void *user_data)
 {
 	rsu_device_t *device;
-	rsu_async_cb_data_t *cb_data;
 
-	device = rsu_device_from_path(task->path, upnp->server_udn_map);
+	device = prv_get_device(upnp, task, TRUE, cb, user_data);
 
-	if (!device) {
-		cb_data = rsu_async_cb_data_new(task, cb, user_data, NULL, NULL,
-						NULL);
-		cb_data->error = g_error_new(RSU_ERROR,
-					     RSU_ERROR_OBJECT_NOT_FOUND,
-					     "Cannot locate a device"
-					     " for the specified "
-					     "object");
-		(void) g_idle_add(rsu_async_complete_task, cb_data);
-	} else {
+	if (device)
 		rsu_device_remove_uri(device, task, upnp->host_service,
 				      cancellable, cb, user_data);
-	}
 }
 
 void rsu_upnp_lost_client(rsu_upnp_t *upnp, const gchar *client_name)
@@ -24,6 +24,7 @@
 #define RSU_UPNP_H__
 
 #include "task.h"
+#include "settings.h"
 
 typedef struct rsu_upnp_t_ rsu_upnp_t;
 
@@ -32,6 +33,7 @@ enum rsu_interface_type_ {
 	RSU_INTERFACE_INFO_ROOT,
 	RSU_INTERFACE_INFO_PLAYER,
 	RSU_INTERFACE_INFO_PUSH_HOST,
+	RSU_INTERFACE_INFO_RENDERER_DEVICE,
 	RSU_INTERFACE_INFO_MAX
 };
 
@@ -46,12 +48,21 @@ typedef void (*rsu_upnp_task_complete_t)(rsu_task_t *task, GVariant *result,
 					 GError *error, void *user_data);
 
 rsu_upnp_t *rsu_upnp_new(GDBusConnection *connection,
+			 rsu_settings_t *settings,
 			 rsu_interface_info_t *interface_info,
 			 rsu_upnp_callback_t found_server,
 			 rsu_upnp_callback_t lost_server,
 			 void *user_data);
 void rsu_upnp_delete(rsu_upnp_t *upnp);
 GVariant *rsu_upnp_get_server_ids(rsu_upnp_t *upnp);
+GVariant *rsu_upnp_get_servers_with_props(rsu_upnp_t *upnp);
+GVariant *rsu_upnp_get_managed_objects(rsu_upnp_t *upnp);
+GVariant *rsu_upnp_get_server_interfaces(rsu_upnp_t *upnp, const gchar *path);
+GVariant *rsu_upnp_get_host_statistics(rsu_upnp_t *upnp);
+gint64 rsu_upnp_get_rtt(rsu_upnp_t *upnp, const gchar *path);
+GVariant *rsu_upnp_get_filter(rsu_upnp_t *upnp);
+gboolean rsu_upnp_set_filter(rsu_upnp_t *upnp, GVariant *filter,
+			     GError **error);
 void rsu_upnp_get_prop(rsu_upnp_t *upnp, rsu_task_t *task,
 		       GCancellable *cancellable,
 		       rsu_upnp_task_complete_t cb,
@@ -60,6 +71,14 @@ void rsu_upnp_get_all_props(rsu_upnp_t *upnp, rsu_task_t *task,
 			    GCancellable *cancellable,
 			    rsu_upnp_task_complete_t cb,
 			    void *user_data);
+void rsu_upnp_get_selected_props(rsu_upnp_t *upnp, rsu_task_t *task,
+				 GCancellable *cancellable,
+				 rsu_upnp_task_complete_t cb,
+				 void *user_data);
+void rsu_upnp_get_changes(rsu_upnp_t *upnp, rsu_task_t *task,
+			  GCancellable *cancellable,
+			  rsu_upnp_task_complete_t cb,
+			  void *user_data);
 void rsu_upnp_play(rsu_upnp_t *upnp, rsu_task_t *task,
 		   GCancellable *cancellable,
 		   rsu_upnp_task_complete_t cb,
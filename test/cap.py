@@ -38,6 +38,8 @@ class Renderer:
                                        'com.intel.RendererServiceUPnP.PushHost')
         self.__playerIF = dbus.Interface(obj,
                                          'org.mpris.MediaPlayer2.Player')
+        self.__deviceIF = dbus.Interface(
+            obj, 'com.intel.RendererServiceUPnP.RendererDevice')
 
 
     def get_prop(self, prop_name, iface = ""):
@@ -48,10 +50,11 @@ class Renderer:
             self.__hostIF.RemoveFile(fname)
         except:
             pass
-        self.__playerIF.Stop()
-        uri = self.__hostIF.HostFile(fname)
-        self.__playerIF.OpenUri(uri)
-        self.__playerIF.Play()
+        self.__deviceIF.Batch([("Stop", []),
+                               ("HostFile", [fname]),
+                               ("OpenUri", [""]),
+                               ("Play", [])],
+                              signature='a(sav)')
 
 class Renderers:
 